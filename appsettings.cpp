@@ -93,6 +93,22 @@ AppSettings::AppSettings(QObject *parent) :
         parent)
 {
     createDefaultValues_();
+    updateShaderNames();
+}
+
+void AppSettings::updateShaderNames()
+{
+    ShaderNames & n = shaderNames_;
+    n.position      = getValue("ShaderAttributes/position").toString().toUtf8();
+    n.normal        = getValue("ShaderAttributes/normal").toString().toUtf8();
+    n.color         = getValue("ShaderAttributes/color").toString().toUtf8();
+    n.texcoord      = getValue("ShaderAttributes/texcoord").toString().toUtf8();
+    n.projection    = getValue("ShaderUniforms/projection").toString().toUtf8();
+    n.view          = getValue("ShaderUniforms/view").toString().toUtf8();
+    n.time          = getValue("ShaderUniforms/time").toString().toUtf8();
+    n.aspect        = getValue("ShaderUniforms/aspect").toString().toUtf8();
+    n.frame         = getValue("ShaderUniforms/frame").toString().toUtf8();
+    n.uniforms      = getShaderUniforms().toSet();
 }
 
 
@@ -102,7 +118,10 @@ void AppSettings::createDefaultValues_()
     defaultValues_.insert("fragment_source", default_fragment_source);
     defaultValues_.insert("source_path", QString("./"));
     defaultValues_.insert("image_path", QString("./"));
+    defaultValues_.insert("capture_file", QString("./capture.png"));
     defaultValues_.insert("auto_compile", true);
+    // semicolon separated list of directories for #include <file>
+    defaultValues_.insert("include_paths", QString("./shader"));
 
     defaultValues_.insert("image0", QString(""));
     defaultValues_.insert("image1", QString(""));
@@ -113,6 +132,12 @@ void AppSettings::createDefaultValues_()
     defaultValues_.insert("RenderSettings/doCullFace", true);
     defaultValues_.insert("RenderSettings/doFrontFaceCCW", true);
     defaultValues_.insert("RenderSettings/doDrawCoords", true);
+    defaultValues_.insert("RenderSettings/doShowHud", true);
+    defaultValues_.insert("RenderSettings/vsync", true);
+    defaultValues_.insert("RenderSettings/targetFps", 60.);
+
+    defaultValues_.insert("ProgramCache/enabled", true);
+    defaultValues_.insert("ProgramCache/maxSizeMB", 64);
 
     defaultValues_.insert("ShaderAttributes/position",  "a_position");
     defaultValues_.insert("ShaderAttributes/color",     "a_color");
@@ -122,6 +147,7 @@ void AppSettings::createDefaultValues_()
     defaultValues_.insert("ShaderUniforms/view",        "u_view");
     defaultValues_.insert("ShaderUniforms/time",        "u_time");
     defaultValues_.insert("ShaderUniforms/aspect",      "u_aspect");
+    defaultValues_.insert("ShaderUniforms/frame",       "u_frame");
 
     // install them if not present already
     auto keys = defaultValues_.keys();
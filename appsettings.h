@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #define APPSETTINGS_H
 
 #include <QSettings>
+#include <QSet>
 
 /** Extended QSettings suited for this application.
 
@@ -35,6 +36,26 @@ class AppSettings : public QSettings
 {
     Q_OBJECT
 public:
+
+    /** The application specific attribute and uniform names,
+        read once from the settings. The byte arrays are
+        zero-terminated and can be passed to opengl directly. */
+    struct ShaderNames
+    {
+        QByteArray
+            position,
+            normal,
+            color,
+            texcoord,
+            projection,
+            view,
+            time,
+            aspect,
+            frame;
+
+        /** all ShaderUniforms names */
+        QSet<QString> uniforms;
+    };
     explicit AppSettings(QObject *parent = 0);
 
     /** Returns a map with default settings */
@@ -60,6 +81,13 @@ public:
     /** Return a list of strings of the names of shader uniforms */
     QStringList getShaderUniforms();
 
+    /** Returns the cached shader attribute and uniform names */
+    const ShaderNames& shaderNames() const { return shaderNames_; }
+
+    /** Reads the shader names again.
+        Call this after changing ShaderAttributes or ShaderUniforms. */
+    void updateShaderNames();
+
 signals:
 
 public slots:
@@ -70,6 +98,8 @@ private:
     void createDefaultValues_();
 
     QMap<QString, QVariant> defaultValues_;
+
+    ShaderNames shaderNames_;
 };
 
 /** Single instance */
@@ -0,0 +1,336 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOffscreenSurface>
+#include <QGuiApplication>
+
+#include "batchcompiler.h"
+#include "glsl.h"
+#include "appsettings.h"
+
+namespace {
+
+    QString readFile(const QString& filename)
+    {
+        QFile f(filename);
+        if (!f.open(QFile::ReadOnly))
+            return QString();
+        return QString::fromUtf8(f.readAll());
+    }
+
+    /** Returns the first existing file of @p names in @p dir, or an empty string */
+    QString findDefault(const QDir& dir, const QStringList& names)
+    {
+        for (auto &n : names)
+            if (dir.exists(n))
+                return dir.filePath(n);
+        return QString();
+    }
+
+    /** Compiles jobs until none are left */
+    class Worker : public QThread
+    {
+    public:
+        Worker(std::vector<BatchCompiler::Job>& jobs,
+               std::vector<std::unique_ptr<Glsl>>& programs,
+               std::atomic<size_t>& next,
+               QOpenGLContext * context, QOffscreenSurface * surface)
+            :   jobs_(jobs), programs_(programs), next_(next),
+                context_(context), surface_(surface)
+        { }
+
+        void run()
+        {
+            if (context_->makeCurrent(surface_))
+            {
+                size_t i;
+                while ((i = next_++) < jobs_.size())
+                    compile_(jobs_[i], *programs_[i]);
+
+                context_->doneCurrent();
+            }
+
+            // give the context back to the gui thread for destruction
+            context_->moveToThread(QCoreApplication::instance()->thread());
+        }
+
+    private:
+
+        void compile_(BatchCompiler::Job& job, Glsl& glsl)
+        {
+            glsl.setVertexSource(job.vertexSource, job.vertexFile);
+            glsl.setFragmentSource(job.fragmentSource, job.fragmentFile);
+
+            job.success = glsl.compile();
+            job.fromCache = glsl.loadedFromCache();
+            job.compileMs = glsl.compileTime();
+            job.linkMs = glsl.linkTime();
+            job.log = glsl.log();
+
+            glsl.releaseGL();
+        }
+
+        std::vector<BatchCompiler::Job>& jobs_;
+        std::vector<std::unique_ptr<Glsl>>& programs_;
+        std::atomic<size_t>& next_;
+        QOpenGLContext * context_;
+        QOffscreenSurface * surface_;
+    };
+
+} // namespace
+
+
+BatchCompiler::BatchCompiler()
+    :   numThreads_ (QThread::idealThreadCount()),
+        totalMs_    (0.)
+{
+}
+
+int BatchCompiler::collect(const QString &directory)
+{
+    jobs_.clear();
+
+    const QStringList defaultVert = QStringList() << "default.vert" << "default140.vert",
+                      defaultFrag = QStringList() << "default.frag" << "default140.frag";
+
+    QDirIterator it(directory, QStringList() << "*.vert" << "*.frag",
+                    QDir::Files, QDirIterator::Subdirectories);
+    QStringList files;
+    while (it.hasNext())
+        files << it.next();
+    files.sort();
+
+    for (auto &f : files)
+    {
+        QFileInfo info(f);
+        QDir dir = info.absoluteDir();
+        const QString base = dir.filePath(info.completeBaseName());
+
+        Job job;
+        job.success = job.fromCache = false;
+        job.compileMs = job.linkMs = 0.;
+
+        if (info.suffix() == "frag")
+        {
+            job.fragmentFile = f;
+            job.vertexFile = QFileInfo(base + ".vert").exists()
+                    ? base + ".vert" : findDefault(dir, defaultVert);
+        }
+        else
+        {
+            // pairs are handled by the .frag file
+            if (QFileInfo(base + ".frag").exists())
+                continue;
+            job.vertexFile = f;
+            job.fragmentFile = findDefault(dir, defaultFrag);
+        }
+
+        // (settings are not read from the worker threads)
+        job.vertexSource = job.vertexFile.isEmpty()
+                ? appSettings->getValue("vertex_source").toString()
+                : readFile(job.vertexFile);
+        job.fragmentSource = job.fragmentFile.isEmpty()
+                ? appSettings->getValue("fragment_source").toString()
+                : readFile(job.fragmentFile);
+
+        jobs_.push_back(job);
+    }
+
+    return jobs_.size();
+}
+
+bool BatchCompiler::run()
+{
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+
+    // main context, only to share with
+    QOffscreenSurface mainSurface;
+    mainSurface.setFormat(format);
+    mainSurface.create();
+    QOpenGLContext mainContext;
+    mainContext.setFormat(format);
+    if (!mainContext.create() || !mainContext.makeCurrent(&mainSurface))
+    {
+        log_ += QString("could not create opengl context on qpa platform '%1'%2, "
+                        "set QT_QPA_PLATFORM to try another one\n")
+                .arg(QGuiApplication::platformName())
+                .arg(qgetenv("EGL_PLATFORM").isEmpty() ? QString()
+                     : QString(" with EGL_PLATFORM=%1")
+                        .arg(QString::fromLocal8Bit(qgetenv("EGL_PLATFORM"))));
+        return false;
+    }
+    QOpenGLFunctions * gl = mainContext.functions();
+    driver_ = QString("%1 %2 %3")
+            .arg((const char*)gl->glGetString(GL_VENDOR))
+            .arg((const char*)gl->glGetString(GL_RENDERER))
+            .arg((const char*)gl->glGetString(GL_VERSION));
+    mainContext.doneCurrent();
+
+    // Glsl reads the AppSettings on construction,
+    // so create them here in the gui thread
+    std::vector<std::unique_ptr<Glsl>> programs;
+    for (size_t i=0; i<jobs_.size(); ++i)
+        programs.push_back(std::unique_ptr<Glsl>(new Glsl));
+
+    // contexts and surfaces are created here in the gui thread
+    // and the contexts are then moved to the workers
+    const int num = std::max(1, std::min(numThreads_, (int)jobs_.size()));
+    std::vector<std::unique_ptr<QOffscreenSurface>> surfaces;
+    std::vector<std::unique_ptr<QOpenGLContext>> contexts;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next(0);
+
+    for (int i=0; i<num; ++i)
+    {
+        std::unique_ptr<QOffscreenSurface> surface(new QOffscreenSurface);
+        surface->setFormat(format);
+        surface->create();
+
+        std::unique_ptr<QOpenGLContext> context(new QOpenGLContext);
+        context->setFormat(format);
+        context->setShareContext(&mainContext);
+        if (!context->create())
+        {
+            log_ += "could not create shared opengl context\n";
+            break;
+        }
+
+        std::unique_ptr<Worker> worker(
+                new Worker(jobs_, programs, next, context.get(), surface.get()));
+        context->moveToThread(worker.get());
+
+        surfaces.push_back(std::move(surface));
+        contexts.push_back(std::move(context));
+        workers.push_back(std::move(worker));
+    }
+
+    if (workers.empty())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (auto &w : workers)
+        w->start();
+    for (auto &w : workers)
+        w->wait();
+
+    totalMs_ = timer.nsecsElapsed() / 1000000.;
+    numThreads_ = workers.size();
+
+    return true;
+}
+
+int BatchCompiler::numFailed() const
+{
+    int n = 0;
+    for (auto &j : jobs_)
+        if (!j.success)
+            ++n;
+    return n;
+}
+
+QJsonObject BatchCompiler::toJson() const
+{
+    QJsonArray programs;
+    for (auto &j : jobs_)
+    {
+        QJsonObject o;
+        o.insert("vertex", j.vertexFile);
+        o.insert("fragment", j.fragmentFile);
+        o.insert("success", j.success);
+        o.insert("from_cache", j.fromCache);
+        o.insert("compile_ms", j.compileMs);
+        o.insert("link_ms", j.linkMs);
+        o.insert("log", j.log);
+        programs.append(o);
+    }
+
+    QJsonObject root;
+    root.insert("driver", driver_);
+    root.insert("threads", numThreads_);
+    root.insert("total_ms", totalMs_);
+    root.insert("failed", numFailed());
+    root.insert("programs", programs);
+    return root;
+}
+
+int BatchCompiler::exec(const QStringList &args)
+{
+    const int idx = args.indexOf("--compile-batch");
+    if (idx < 0 || idx + 1 >= args.size())
+    {
+        std::cerr << "usage: scheeder --compile-batch <dir> [--threads <n>] [--output <file.json>]\n";
+        return 2;
+    }
+
+    BatchCompiler bc;
+
+    const int t = args.indexOf("--threads");
+    if (t >= 0 && t + 1 < args.size())
+        bc.setNumThreads(std::max(1, args[t + 1].toInt()));
+
+    if (!bc.collect(args[idx + 1]))
+    {
+        std::cerr << "no shaders found in " << args[idx + 1].toStdString() << "\n";
+        return 2;
+    }
+
+    if (!bc.run())
+    {
+        std::cerr << bc.log_.toStdString();
+        return 2;
+    }
+
+    const QByteArray json = QJsonDocument(bc.toJson()).toJson();
+
+    const int o = args.indexOf("--output");
+    if (o >= 0 && o + 1 < args.size())
+    {
+        QFile f(args[o + 1]);
+        if (!f.open(QFile::WriteOnly | QFile::Truncate))
+        {
+            std::cerr << "could not write " << args[o + 1].toStdString() << "\n";
+            return 2;
+        }
+        f.write(json);
+    }
+    else
+        std::cout << json.constData();
+
+    return bc.numFailed() ? 1 : 0;
+}
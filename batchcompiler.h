@@ -0,0 +1,91 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef BATCHCOMPILER_H
+#define BATCHCOMPILER_H
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+
+/** Compiles all shader programs in a directory without gui.
+
+    <p>Every .frag file is paired with the .vert file of the same name.
+    If there is none, the directory's default.vert or default140.vert is used,
+    or the default vertex source of the application. The same goes for
+    .vert files without a .frag file. Subdirectories are included.</p>
+
+    <p>The programs are compiled by a number of threads, each with an
+    offscreen opengl context shared with a main context. The result is
+    a json document with compile time, link time, log and success
+    per program. Linked programs end up in the ProgramCache, if enabled.</p>
+
+    Usage from the command line:
+    @code
+    scheeder --compile-batch <dir> [--threads <n>] [--output <file.json>]
+    @endcode
+*/
+class BatchCompiler
+{
+public:
+
+    /** One program */
+    struct Job
+    {
+        QString vertexFile, fragmentFile,
+                vertexSource, fragmentSource;
+        bool success, fromCache;
+        double compileMs, linkMs;
+        QString log;
+    };
+
+    BatchCompiler();
+
+    /** Sets the number of threads, default is QThread::idealThreadCount() */
+    void setNumThreads(int num) { numThreads_ = num; }
+
+    /** Collects all programs in the directory. Returns the number of programs. */
+    int collect(const QString& directory);
+
+    /** Compiles all collected programs.
+        Returns false if the opengl contexts could not be created. */
+    bool run();
+
+    /** Returns the number of programs that failed */
+    int numFailed() const;
+
+    /** Returns the result as json */
+    QJsonObject toJson() const;
+
+    /** Runs the command line mode with the application's arguments.
+        Returns the exit code: 0 = all compiled, 1 = some failed, 2 = error */
+    static int exec(const QStringList& arguments);
+
+private:
+
+    std::vector<Job> jobs_;
+    int numThreads_;
+    double totalMs_;
+    QString driver_, log_;
+};
+
+#endif // BATCHCOMPILER_H
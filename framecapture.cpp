@@ -0,0 +1,448 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QImage>
+#include <QFileInfo>
+#include <QDir>
+
+#include "framecapture.h"
+#include "debug.h"
+
+
+class FrameCapture::Job : public QRunnable
+{
+public:
+    Job(FrameCapture * fc, int frame, std::vector<unsigned char>& pixels)
+        : fc_(fc), frame_(frame)
+    { pixels_.swap(pixels); }
+
+    void run() Q_DECL_OVERRIDE { fc_->encode_(frame_, pixels_); }
+
+private:
+    FrameCapture * fc_;
+    int frame_;
+    std::vector<unsigned char> pixels_;
+};
+
+
+FrameCapture::FrameCapture()
+    :   slotIndex_      (0),
+        glInitialized_  (false),
+        capturing_      (false),
+        format_         (F_PNG),
+        width_          (0),
+        height_         (0),
+        frame_          (0),
+        fps_            (0.),
+        maxQueued_      (0),
+        queued_         (0),
+        captured_       (0),
+        written_        (0),
+        stalls_         (0),
+        lost_           (0),
+        nextWrite_      (0)
+{
+    for (int i=0; i<numSlots_; ++i)
+    {
+        slots_[i].pbo = 0;
+        slots_[i].fence = 0;
+        slots_[i].frame = 0;
+        slots_[i].pending = false;
+    }
+
+    pool_.setMaxThreadCount(std::max(2, QThread::idealThreadCount() - 1));
+    // a few frames per worker keep them busy while the gui thread renders
+    maxQueued_ = pool_.maxThreadCount() * 2;
+}
+
+FrameCapture::~FrameCapture()
+{
+    pool_.waitForDone();
+}
+
+FrameCapture::Format FrameCapture::formatForFile(const QString &filename)
+{
+    const QString ext = QFileInfo(filename).suffix().toLower();
+    if (ext == "y4m")
+        return F_Y4M;
+    if (ext == "rgba" || ext == "raw")
+        return F_RAW;
+    return F_PNG;
+}
+
+void FrameCapture::initGL_()
+{
+#ifdef SCH_USE_QT_OPENGLFUNC
+    initializeOpenGLFunctions();
+#endif
+    for (int i=0; i<numSlots_; ++i)
+        SCH_CHECK_GL( glGenBuffers(1, &slots_[i].pbo) );
+    glInitialized_ = true;
+}
+
+void FrameCapture::releaseGL()
+{
+    if (!glInitialized_)
+        return;
+
+    for (int i=0; i<numSlots_; ++i)
+    {
+        if (slots_[i].fence)
+            glDeleteSync(slots_[i].fence);
+        SCH_CHECK_GL( glDeleteBuffers(1, &slots_[i].pbo) );
+        slots_[i].pbo = 0;
+        slots_[i].fence = 0;
+        slots_[i].pending = false;
+    }
+    glInitialized_ = false;
+}
+
+bool FrameCapture::start(const QString &filename, int width, int height, double fps)
+{
+    if (capturing_)
+        return false;
+
+    error_.clear();
+    filename_ = filename;
+    format_ = formatForFile(filename);
+    width_ = width;
+    height_ = height;
+    fps_ = fps;
+    frame_ = nextWrite_ = 0;
+    captured_ = written_ = stalls_ = lost_ = 0;
+    ready_.clear();
+
+    if (format_ == F_Y4M)
+    {
+        // 4:2:0 needs an even size, the frames are full range BT.601
+        width_ &= ~1;
+        height_ &= ~1;
+
+        file_.setFileName(filename);
+        if (!file_.open(QIODevice::WriteOnly))
+        {
+            error_ = QString("Could not create file %1\n%2")
+                        .arg(filename).arg(file_.errorString());
+            return false;
+        }
+        const int rate = fps > 0. ? int(fps * 1000. + .5) : 60000;
+        file_.write(QString("YUV4MPEG2 W%1 H%2 F%3:1000 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n")
+                    .arg(width_).arg(height_).arg(rate).toLatin1());
+    }
+    else if (!QFileInfo(filename).absoluteDir().exists())
+    {
+        error_ = QString("Directory of %1 does not exist").arg(filename);
+        return false;
+    }
+
+    if (width_ < 2 || height_ < 2)
+    {
+        error_ = QString("Can not capture %1x%2 frames").arg(width).arg(height);
+        file_.close();
+        return false;
+    }
+
+    capturing_ = true;
+    return true;
+}
+
+bool FrameCapture::capture(int width, int height)
+{
+    if (!capturing_)
+        return false;
+
+    if ((format_ == F_Y4M ? (width & ~1) != width_ || (height & ~1) != height_
+                          : width != width_ || height != height_))
+        return false;
+
+    if (!glInitialized_)
+        initGL_();
+
+    // map all buffers that are ready by now
+    for (int i=0; i<numSlots_; ++i)
+    {
+        Slot& s = slots_[(slotIndex_ + i) % numSlots_];
+        if (s.pending && !readSlot_(s, false))
+            break;
+    }
+
+    Slot& slot = slots_[slotIndex_];
+    slotIndex_ = (slotIndex_ + 1) % numSlots_;
+
+    // whole ring in flight, wait for the oldest frame
+    if (slot.pending)
+    {
+        ++stalls_;
+        readSlot_(slot, true);
+    }
+
+    const int size = width_ * height_ * 4;
+
+    SCH_CHECK_GL( glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo) );
+    SCH_CHECK_GL( glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ) );
+    SCH_CHECK_GL( glPixelStorei(GL_PACK_ALIGNMENT, 4) );
+    // returns immediately, the copy happens on the gpu
+    SCH_CHECK_GL( glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, 0) );
+    SCH_CHECK_GL( glBindBuffer(GL_PIXEL_PACK_BUFFER, 0) );
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = frame_++;
+    slot.pending = true;
+
+    return true;
+}
+
+bool FrameCapture::readSlot_(Slot &slot, bool wait)
+{
+    GLenum res = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                  wait ? 1000000000 : 0);
+    if (res == GL_TIMEOUT_EXPIRED && !wait)
+        return false;
+
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    slot.pending = false;
+
+    if (res == GL_WAIT_FAILED || res == GL_TIMEOUT_EXPIRED)
+    {
+        lostFrame_(slot.frame);
+        return true;
+    }
+
+    const size_t size = width_ * height_ * 4;
+    std::vector<unsigned char> pixels(size);
+
+    SCH_CHECK_GL( glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo) );
+    auto src = static_cast<const unsigned char*>(
+                glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+    if (src)
+    {
+        memcpy(&pixels[0], src, size);
+        SCH_CHECK_GL( glUnmapBuffer(GL_PIXEL_PACK_BUFFER) );
+    }
+    SCH_CHECK_GL( glBindBuffer(GL_PIXEL_PACK_BUFFER, 0) );
+
+    if (!src)
+    {
+        lostFrame_(slot.frame);
+        return true;
+    }
+
+    ++captured_;
+    submit_(slot.frame, pixels);
+    return true;
+}
+
+void FrameCapture::stop()
+{
+    if (!capturing_)
+        return;
+
+    // collect the frames still in flight, oldest first
+    for (int i=0; i<numSlots_; ++i)
+    {
+        Slot& s = slots_[(slotIndex_ + i) % numSlots_];
+        if (s.pending)
+            readSlot_(s, true);
+    }
+
+    pool_.waitForDone();
+
+    if (file_.isOpen())
+    {
+        if (!ready_.isEmpty())
+            std::cerr << "FrameCapture: " << ready_.size() << " frames not written\n";
+        ready_.clear();
+        lastWritten_.clear();
+        file_.close();
+    }
+
+    capturing_ = false;
+}
+
+void FrameCapture::submit_(int frame, std::vector<unsigned char>& pixels)
+{
+    {
+        // back-pressure: wait until an encoder is done
+        QMutexLocker lock(&mutex_);
+        while (queued_ >= maxQueued_)
+            queueFree_.wait(&mutex_);
+        ++queued_;
+    }
+
+    pool_.start(new Job(this, frame, pixels));
+}
+
+void FrameCapture::encode_(int frame, std::vector<unsigned char>& pixels)
+{
+    const int rowSize = width_ * 4;
+
+    if (format_ == F_Y4M)
+    {
+        writeOrdered_(frame, toY4M_(pixels));
+    }
+    else
+    {
+        // opengl's rows start at the bottom
+        std::vector<unsigned char> row(rowSize);
+        for (int y=0; y<height_ / 2; ++y)
+        {
+            unsigned char
+                    * a = &pixels[y * rowSize],
+                    * b = &pixels[(height_ - 1 - y) * rowSize];
+            memcpy(&row[0], a, rowSize);
+            memcpy(a, b, rowSize);
+            memcpy(b, &row[0], rowSize);
+        }
+
+        const QString fn = frameFile_(frame);
+        bool ok;
+        if (format_ == F_PNG)
+        {
+            QImage img(&pixels[0], width_, height_, rowSize, QImage::Format_RGBA8888);
+            ok = img.save(fn, "PNG");
+        }
+        else
+        {
+            QFile f(fn);
+            ok = f.open(QIODevice::WriteOnly)
+                && f.write((const char*)&pixels[0], pixels.size()) == (qint64)pixels.size();
+        }
+
+        if (ok)
+            ++written_;
+        else
+            std::cerr << "FrameCapture: could not write " << fn.toStdString() << "\n";
+    }
+
+    QMutexLocker lock(&mutex_);
+    --queued_;
+    queueFree_.wakeAll();
+}
+
+QByteArray FrameCapture::toY4M_(const std::vector<unsigned char> &pixels) const
+{
+    static const char header[] = "FRAME\n";
+    const int hsize = sizeof(header) - 1,
+              w2 = width_ / 2, h2 = height_ / 2,
+              ysize = width_ * height_,
+              csize = w2 * h2;
+
+    QByteArray data(hsize + ysize + csize * 2, 0);
+    memcpy(data.data(), header, hsize);
+
+    auto py = reinterpret_cast<unsigned char*>(data.data()) + hsize,
+         pu = py + ysize,
+         pv = pu + csize;
+
+    // full range BT.601 in 16 bit fixed point
+    for (int y=0; y<height_; ++y)
+    {
+        const unsigned char * src = &pixels[(height_ - 1 - y) * width_ * 4];
+        unsigned char * dst = py + y * width_;
+        for (int x=0; x<width_; ++x, src += 4)
+            dst[x] = (19595 * src[0] + 38470 * src[1] + 7471 * src[2] + 32768) >> 16;
+    }
+
+    // chroma from the average of each 2x2 block
+    for (int y=0; y<h2; ++y)
+    {
+        const unsigned char
+                * r0 = &pixels[(height_ - 1 - y * 2) * width_ * 4],
+                * r1 = r0 - width_ * 4;
+        for (int x=0; x<w2; ++x, r0 += 8, r1 += 8)
+        {
+            const int
+                r = r0[0] + r0[4] + r1[0] + r1[4],
+                g = r0[1] + r0[5] + r1[1] + r1[5],
+                b = r0[2] + r0[6] + r1[2] + r1[6];
+            const int
+                u = (-11059 * r - 21709 * g + 32768 * b) / 4 + (128 << 16) + 32768,
+                v = ( 32768 * r - 27439 * g -  5329 * b) / 4 + (128 << 16) + 32768;
+            pu[y * w2 + x] = std::max(0, std::min(255, u >> 16));
+            pv[y * w2 + x] = std::max(0, std::min(255, v >> 16));
+        }
+    }
+
+    return data;
+}
+
+void FrameCapture::lostFrame_(int frame)
+{
+    std::cerr << "FrameCapture: lost frame " << frame << "\n";
+    ++lost_;
+
+    // the video writer waits for each frame number
+    if (format_ == F_Y4M)
+        writeOrdered_(frame, QByteArray());
+}
+
+void FrameCapture::writeOrdered_(int frame, const QByteArray& data)
+{
+    QMutexLocker lock(&mutex_);
+
+    ready_.insert(frame, data);
+
+    // a frame that never arrives would hold back all following ones,
+    // so give up on it once enough frames are waiting
+    if (ready_.size() > maxQueued_ * 2 && ready_.firstKey() > nextWrite_)
+    {
+        std::cerr << "FrameCapture: frames " << nextWrite_ << "-"
+                  << ready_.firstKey() - 1 << " missing\n";
+        while (nextWrite_ < ready_.firstKey())
+            writeFrame_(QByteArray());
+    }
+
+    // write everything that is contiguous from the last written frame
+    while (!ready_.isEmpty() && ready_.firstKey() == nextWrite_)
+        writeFrame_(ready_.take(nextWrite_));
+}
+
+void FrameCapture::writeFrame_(const QByteArray& data)
+{
+    // an empty frame repeats the previous one to keep the timing
+    if (!data.isEmpty())
+        lastWritten_ = data;
+    const QByteArray& d = lastWritten_;
+
+    if (!d.isEmpty())
+    {
+        if (file_.write(d) == d.size())
+            ++written_;
+        else
+            std::cerr << "FrameCapture: could not write frame " << nextWrite_ << "\n";
+    }
+    ++nextWrite_;
+}
+
+QString FrameCapture::frameFile_(int frame) const
+{
+    QFileInfo inf(filename_);
+    return inf.absoluteDir().filePath(
+                QString("%1_%2.%3").arg(inf.completeBaseName())
+                                   .arg(frame, 5, 10, QChar('0'))
+                                   .arg(inf.suffix()));
+}
@@ -0,0 +1,194 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <vector>
+#include <atomic>
+
+#include <QString>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+
+#include "opengl.h"
+
+/** @brief Records the rendered frames into image sequences or a video file.
+
+    <p>capture() starts an asynchronous glReadPixels() into one of a ring
+    of pixel pack buffers and guards it with a fence. The pixels of a
+    buffer are only mapped once it's fence is signaled, a few frames
+    later, so the readback does not stall the GPU. Only when all buffers
+    are still in flight does capture() wait for the oldest one.</p>
+
+    <p>Encoding runs on a thread pool. The number of frames waiting for
+    encoding is bounded. When the queue is full, capture() blocks until
+    a worker is done, which slows down the renderer instead of using up
+    the memory.</p>
+
+    <p>Output formats, chosen by the file extension:
+    <ul>
+    <li>.png - one png file per frame</li>
+    <li>.rgba - one file per frame with the raw RGBA bytes, top row first</li>
+    <li>.y4m - one YUV4MPEG2 video file (4:2:0, full range), frames are written in order</li>
+    </ul>
+    Sequence files get the frame number appended, e.g. capture_00012.png.</p>
+*/
+class FrameCapture
+#ifdef SCH_USE_QT_OPENGLFUNC
+    :   protected QOpenGLFunctions_3_3_Core
+#endif
+{
+public:
+
+    enum Format
+    {
+        F_PNG,
+        F_RAW,
+        F_Y4M
+    };
+
+    FrameCapture();
+    /** Waits for the encoders, stop() should have been called before */
+    ~FrameCapture();
+
+    // ----------- query ---------------------
+
+    bool isCapturing() const { return capturing_; }
+
+    /** Size of the captured frames */
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    /** Frame rate passed to start() */
+    double fps() const { return fps_; }
+
+    /** Number of frames read from the gpu */
+    int numCaptured() const { return captured_; }
+
+    /** Number of frames written to disk */
+    int numWritten() const { return written_; }
+
+    /** Number of frames waiting for or in encoding */
+    int numQueued() const { return queued_; }
+
+    /** Number of times capture() had to wait for the gpu */
+    int numStalls() const { return stalls_; }
+
+    /** Number of frames that could not be read from the gpu.
+        The video repeats the previous frame in their place. */
+    int numLost() const { return lost_; }
+
+    /** Returns the last error */
+    const QString& error() const { return error_; }
+
+    /** Returns the format for the extension of the file */
+    static Format formatForFile(const QString& filename);
+
+    // ------------ capture ------------------
+
+    /** Starts a new recording of frames with the given size.
+        @p fps is only used for the y4m header.
+        Returns false if the output file can not be written. */
+    bool start(const QString& filename, int width, int height, double fps);
+
+    /** Reads the current framebuffer, call after rendering a frame.
+        Returns false if the framebuffer size differs from the recording.
+        @note Needs the opengl context. */
+    bool capture(int width, int height);
+
+    /** Reads the remaining frames, waits for the encoders and closes the file.
+        @note Needs the opengl context. */
+    void stop();
+
+    /** Deletes the pixel buffers */
+    void releaseGL();
+
+private:
+
+    /** Encodes one frame on a pool thread */
+    class Job;
+
+    struct Slot
+    {
+        GLuint pbo;
+        GLsync fence;
+        int frame;
+        bool pending;
+    };
+
+    void initGL_();
+
+    /** Maps the buffer of the slot and queues the pixels for encoding.
+        Returns false if the fence is not signaled and @p wait is false. */
+    bool readSlot_(Slot& slot, bool wait);
+
+    /** Queues the frame, blocks while the queue is full */
+    void submit_(int frame, std::vector<unsigned char>& pixels);
+
+    /** Called from a Job */
+    void encode_(int frame, std::vector<unsigned char>& pixels);
+
+    /** Converts bottom-up RGBA to a YUV4MPEG2 frame */
+    QByteArray toY4M_(const std::vector<unsigned char>& pixels) const;
+
+    /** Counts the frame and lets the video writer skip it */
+    void lostFrame_(int frame);
+
+    /** Writes the video frames in order of their frame numbers.
+        An empty @p data marks a lost frame. */
+    void writeOrdered_(int frame, const QByteArray& data);
+
+    /** Writes the next video frame, mutex_ must be locked */
+    void writeFrame_(const QByteArray& data);
+
+    /** Returns the file name of a sequence frame */
+    QString frameFile_(int frame) const;
+
+    static const int numSlots_ = 3;
+    Slot slots_[numSlots_];
+    int slotIndex_;
+    bool glInitialized_, capturing_;
+
+    QString filename_, error_;
+    Format format_;
+    int width_, height_, frame_;
+    double fps_;
+
+    // --- encoding ---
+
+    QThreadPool pool_;
+    QMutex mutex_;
+    QWaitCondition queueFree_;
+    int maxQueued_;
+    std::atomic<int> queued_, captured_, written_, stalls_, lost_;
+
+    /** video file and the frames that wait for their predecessors */
+    QFile file_;
+    QMap<int, QByteArray> ready_;
+    QByteArray lastWritten_;
+    int nextWrite_;
+};
+
+#endif // FRAMECAPTURE_H
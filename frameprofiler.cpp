@@ -0,0 +1,271 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+
+#include <QPainter>
+#include <QRect>
+#include <QFont>
+
+#include "frameprofiler.h"
+#include "debug.h"
+
+void FrameProfiler::Ring::push(float v)
+{
+    values[index] = v;
+    index = (index + 1) % values.size();
+    count = std::min(count + 1, (int)values.size());
+}
+
+float FrameProfiler::Ring::at(int i) const
+{
+    const int n = values.size();
+    return values[(index - count + i + n) % n];
+}
+
+
+FrameProfiler::FrameProfiler()
+    :   queryIndex_     (0),
+        gpuActive_      (false),
+        glInitialized_  (false)
+{
+    for (int i=0; i<numQueries_; ++i)
+    {
+        queries_[i].id = 0;
+        queries_[i].pending = false;
+    }
+
+    for (int i=0; i<S_MAX; ++i)
+    {
+        samples_[i].values.resize(numSamples_);
+        samples_[i].index = samples_[i].count = 0;
+        phaseBegin_[i] = frameNs_[i] = 0;
+    }
+
+    timer_.start();
+}
+
+const char * FrameProfiler::name(Series s)
+{
+    switch (s)
+    {
+        case S_GPU:      return "gpu draw";
+        case S_FRAME:    return "frame";
+        case S_TEXTURES: return "textures";
+        case S_COMPILE:  return "compile";
+        case S_UNIFORMS: return "uniforms";
+        case S_DRAW:     return "draw";
+        case S_MAX: break;
+    }
+    return "";
+}
+
+void FrameProfiler::initGL_()
+{
+#ifdef SCH_USE_QT_OPENGLFUNC
+    initializeOpenGLFunctions();
+#endif
+    for (int i=0; i<numQueries_; ++i)
+        SCH_CHECK_GL( glGenQueries(1, &queries_[i].id) );
+    glInitialized_ = true;
+}
+
+void FrameProfiler::releaseGL()
+{
+    if (!glInitialized_)
+        return;
+
+    for (int i=0; i<numQueries_; ++i)
+    {
+        SCH_CHECK_GL( glDeleteQueries(1, &queries_[i].id) );
+        queries_[i].id = 0;
+        queries_[i].pending = false;
+    }
+    glInitialized_ = false;
+}
+
+void FrameProfiler::beginFrame()
+{
+    for (int i=0; i<S_MAX; ++i)
+        frameNs_[i] = 0;
+
+    if (glInitialized_)
+        readQueries_();
+
+    beginPhase(S_FRAME);
+}
+
+void FrameProfiler::endFrame()
+{
+    endPhase(S_FRAME);
+
+    // gpu results are added when they arrive
+    for (int i=S_FRAME; i<S_MAX; ++i)
+        samples_[i].push(frameNs_[i] / 1000000.f);
+}
+
+void FrameProfiler::beginPhase(Series s)
+{
+    phaseBegin_[s] = timer_.nsecsElapsed();
+}
+
+void FrameProfiler::endPhase(Series s)
+{
+    frameNs_[s] += timer_.nsecsElapsed() - phaseBegin_[s];
+}
+
+void FrameProfiler::beginGpu()
+{
+    if (!glInitialized_)
+        initGL_();
+
+    // all queries still in flight, skip this frame
+    // instead of waiting for the result
+    gpuActive_ = !queries_[queryIndex_].pending;
+    if (gpuActive_)
+        SCH_CHECK_GL( glBeginQuery(GL_TIME_ELAPSED, queries_[queryIndex_].id) );
+}
+
+void FrameProfiler::endGpu()
+{
+    if (!gpuActive_)
+        return;
+
+    SCH_CHECK_GL( glEndQuery(GL_TIME_ELAPSED) );
+    queries_[queryIndex_].pending = true;
+    queryIndex_ = (queryIndex_ + 1) % numQueries_;
+    gpuActive_ = false;
+}
+
+void FrameProfiler::readQueries_()
+{
+    // the query after the last used one is the oldest
+    for (int j=0; j<numQueries_; ++j)
+    {
+        Query& q = queries_[(queryIndex_ + j) % numQueries_];
+        if (!q.pending)
+            continue;
+
+        GLint available = 0;
+        SCH_CHECK_GL( glGetQueryObjectiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available) );
+        // later ones won't be ready either
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        SCH_CHECK_GL( glGetQueryObjectui64v(q.id, GL_QUERY_RESULT, &ns) );
+        samples_[S_GPU].push(ns / 1000000.f);
+        q.pending = false;
+    }
+}
+
+FrameProfiler::Stats FrameProfiler::stats(Series s) const
+{
+    Stats st;
+    const Ring& r = samples_[s];
+    if (r.count <= 0)
+        return st;
+
+    std::vector<float> v(r.count);
+    for (int i=0; i<r.count; ++i)
+        v[i] = r.at(i);
+
+    st.count = r.count;
+    st.current = v.back();
+    st.min = *std::min_element(v.begin(), v.end());
+    st.max = *std::max_element(v.begin(), v.end());
+
+    // (a partial sort is enough)
+    auto p = v.begin() + (int)(0.95f * (r.count - 1));
+    std::nth_element(v.begin(), p, v.end());
+    st.p95 = *p;
+
+    return st;
+}
+
+void FrameProfiler::paint(QPainter& p, const QRect& rect) const
+{
+    p.save();
+    p.fillRect(rect, QColor(0, 0, 0, 160));
+
+    QFont font("Monospace", 8);
+    font.setStyleHint(QFont::TypeWriter);
+    p.setFont(font);
+    const int lh = p.fontMetrics().height();
+
+    // --- table ---
+
+    int y = rect.top() + lh;
+    const int x = rect.left() + 4;
+    p.setPen(QColor(200, 200, 200));
+    p.drawText(x, y, "             cur    min    max    p95 ms");
+
+    for (int i=0; i<S_MAX; ++i)
+    {
+        const Stats s = stats((Series)i);
+        y += lh;
+        p.setPen(i == S_GPU ? QColor(100, 255, 100)
+               : i == S_FRAME ? QColor(255, 255, 255) : QColor(200, 200, 200));
+        p.drawText(x, y, QString("%1 %2 %3 %4 %5")
+                   .arg(QString(name((Series)i)), -9)
+                   .arg(s.current, 6, 'f', 2).arg(s.min, 6, 'f', 2)
+                   .arg(s.max, 6, 'f', 2).arg(s.p95, 6, 'f', 2));
+    }
+
+    // --- graph of cpu frame and gpu time ---
+
+    const QRect g(rect.left() + 4, y + lh / 2,
+                  rect.width() - 8, rect.bottom() - y - lh / 2 - 4);
+    if (g.height() < 8)
+    {
+        p.restore();
+        return;
+    }
+
+    // scale to the maximum, but at least to 60 fps
+    float maxMs = 1000.f / 60.f;
+    const Series graphed[] = { S_FRAME, S_GPU };
+    for (auto s : graphed)
+        for (int i=0; i<samples_[s].count; ++i)
+            maxMs = std::max(maxMs, samples_[s].at(i));
+
+    // 60 fps line
+    const int y60 = g.bottom() - int(g.height() * (1000.f / 60.f) / maxMs);
+    p.setPen(QPen(QColor(255, 100, 100), 1, Qt::DashLine));
+    p.drawLine(g.left(), y60, g.right(), y60);
+
+    for (auto s : graphed)
+    {
+        const Ring& r = samples_[s];
+        if (r.count < 2)
+            continue;
+
+        // newest sample at the right edge
+        QPolygonF line;
+        for (int i=0; i<r.count; ++i)
+            line << QPointF(g.right() - float(r.count - 1 - i) * g.width() / numSamples_,
+                            g.bottom() - g.height() * r.at(i) / maxMs);
+
+        p.setPen(s == S_GPU ? QColor(100, 255, 100) : QColor(255, 255, 255));
+        p.drawPolyline(line);
+    }
+
+    p.restore();
+}
@@ -0,0 +1,155 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <vector>
+
+#include <QElapsedTimer>
+
+#include "opengl.h"
+
+class QPainter;
+class QRect;
+
+/** @brief Collects CPU and GPU timings of the render phases.
+
+    <p>CPU phases are measured with a monotonic clock between
+    beginPhase() and endPhase(). The GPU time between beginGpu() and
+    endGpu() is measured with GL_TIME_ELAPSED queries in a ring of
+    query objects. Results are only read when the driver reports them
+    available, so reading never stalls the pipeline. A result arrives
+    one or more frames late.</p>
+
+    <p>Each series keeps a rolling window of samples, from which
+    stats() computes the current, minimum, maximum and 95th percentile.
+    paint() draws all of it, plus a frame-time graph, as an overlay.</p>
+*/
+class FrameProfiler
+#ifdef SCH_USE_QT_OPENGLFUNC
+    :   protected QOpenGLFunctions_3_3_Core
+#endif
+{
+public:
+
+    /** The measured series */
+    enum Series
+    {
+        /** gpu time of the draw */
+        S_GPU,
+        /** cpu time of the whole frame */
+        S_FRAME,
+        S_TEXTURES,
+        S_COMPILE,
+        S_UNIFORMS,
+        S_DRAW,
+        S_MAX
+    };
+
+    /** Statistics of one series in milliseconds */
+    struct Stats
+    {
+        float current, min, max, p95;
+        /** number of samples in the window */
+        int count;
+
+        Stats() : current(0.f), min(0.f), max(0.f), p95(0.f), count(0) { }
+    };
+
+    FrameProfiler();
+
+    /** Returns a readable name for the series */
+    static const char * name(Series);
+
+    /** Returns the statistics over the window of the series */
+    Stats stats(Series) const;
+
+    // ---------- measurement -------------
+
+    /** Starts the cpu time of a frame and reads available gpu results */
+    void beginFrame();
+
+    /** Adds the cpu samples of the frame */
+    void endFrame();
+
+    /** Starts the cpu time of a phase */
+    void beginPhase(Series);
+
+    /** Ends the cpu time of a phase.
+        A phase can be measured several times per frame, the times add up. */
+    void endPhase(Series);
+
+    /** Starts a gpu timer query, if a query object is free */
+    void beginGpu();
+
+    /** Ends the gpu timer query */
+    void endGpu();
+
+    // ------------ output ----------------
+
+    /** Draws the statistics and a frame-time graph into @p rect */
+    void paint(QPainter& painter, const QRect& rect) const;
+
+    /** Deletes the query objects */
+    void releaseGL();
+
+private:
+
+    /** A rolling window of samples */
+    struct Ring
+    {
+        std::vector<float> values;
+        int index, count;
+
+        void push(float v);
+        /** i = 0 is the oldest sample */
+        float at(int i) const;
+    };
+
+    /** Reads all finished queries, oldest first */
+    void readQueries_();
+
+    void initGL_();
+
+    static const int
+        numQueries_ = 4,
+        numSamples_ = 240;
+
+    struct Query
+    {
+        GLuint id;
+        bool pending;
+    };
+
+    Query queries_[numQueries_];
+    /** next query to use */
+    int queryIndex_;
+    bool gpuActive_, glInitialized_;
+
+    QElapsedTimer timer_;
+    qint64 phaseBegin_[S_MAX];
+    /** cpu times of the current frame in nanoseconds */
+    qint64 frameNs_[S_MAX];
+
+    Ring samples_[S_MAX];
+};
+
+#endif // FRAMEPROFILER_H
@@ -0,0 +1,185 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <algorithm>
+
+#include <QTimer>
+
+#include "framescheduler.h"
+
+FrameScheduler::FrameScheduler(QObject * parent)
+    :   QObject     (parent),
+        timer_      (new QTimer(this)),
+        targetFps_  (60.),
+        running_    (false),
+        inFrame_    (false),
+        due_        (false),
+        dueFrame_   (false),
+        nextDue_    (0),
+        frameBegin_ (0),
+        lastBegin_  (-1),
+        frameNs_    (numSamples_),
+        workNs_     (numSamples_),
+        sampleIndex_(0),
+        numSampled_ (0),
+        late_       (0)
+{
+    clock_.start();
+    time_.start();
+
+    // (the default coarse timer is off by up to 5%)
+    timer_->setTimerType(Qt::PreciseTimer);
+    timer_->setSingleShot(true);
+    connect(timer_, SIGNAL(timeout()), this, SLOT(onTimeout_()));
+}
+
+double FrameScheduler::time() const
+{
+    return time_.nsecsElapsed() / 1000000000.;
+}
+
+void FrameScheduler::setTargetFps(double fps)
+{
+    targetFps_ = std::max(0., fps);
+    nextDue_ = clock_.nsecsElapsed();
+    clearStats_();
+}
+
+void FrameScheduler::start()
+{
+    running_ = true;
+    nextDue_ = clock_.nsecsElapsed();
+    clearStats_();
+    onTimeout_();
+}
+
+void FrameScheduler::onTimeout_()
+{
+    due_ = true;
+    emit frameDue();
+}
+
+void FrameScheduler::stop()
+{
+    running_ = false;
+    due_ = false;
+    timer_->stop();
+}
+
+void FrameScheduler::restartClock()
+{
+    time_.restart();
+}
+
+void FrameScheduler::clearStats_()
+{
+    sampleIndex_ = numSampled_ = late_ = 0;
+    lastBegin_ = -1;
+}
+
+void FrameScheduler::beginFrame()
+{
+    frameBegin_ = clock_.nsecsElapsed();
+    inFrame_ = true;
+    // otherwise it's a repaint from input, expose events and such
+    dueFrame_ = due_;
+    due_ = false;
+}
+
+void FrameScheduler::endFrame()
+{
+    if (!inFrame_)
+        return;
+    inFrame_ = false;
+
+    const qint64 now = clock_.nsecsElapsed();
+
+    // Extra repaints in between do not count. They neither move the due time
+    // nor go into the statistics, the next frame is already scheduled.
+    if (!dueFrame_)
+    {
+        if (running_ && !timer_->isActive() && !due_)
+            timer_->start(0);
+        return;
+    }
+    dueFrame_ = false;
+
+    // statistics (only while running, single repaints would spoil them)
+    if (running_)
+    {
+        if (lastBegin_ >= 0)
+        {
+            frameNs_[sampleIndex_] = frameBegin_ - lastBegin_;
+            workNs_[sampleIndex_] = now - frameBegin_;
+            sampleIndex_ = (sampleIndex_ + 1) % numSamples_;
+            numSampled_ = std::min(numSampled_ + 1, (int)numSamples_);
+        }
+        lastBegin_ = frameBegin_;
+    }
+
+    if (!running_)
+        return;
+
+    // uncapped: as soon as pending events are handled
+    if (targetFps_ <= 0.)
+    {
+        timer_->start(0);
+        return;
+    }
+
+    const qint64 period = qint64(1000000000. / targetFps_);
+    nextDue_ = std::min(nextDue_ + period, now + period);
+
+    // missed the slot, start the next frame right away
+    // but do not try to catch up
+    if (nextDue_ < now)
+    {
+        ++late_;
+        nextDue_ = now;
+    }
+
+    timer_->start(int((nextDue_ - now) / 1000000));
+}
+
+FrameScheduler::Stats FrameScheduler::stats() const
+{
+    Stats s;
+    if (numSampled_ <= 0)
+        return s;
+
+    qint64 frameSum = 0, workSum = 0, frameMax = 0, workMax = 0;
+    for (int i=0; i<numSampled_; ++i)
+    {
+        frameSum += frameNs_[i];
+        workSum += workNs_[i];
+        frameMax = std::max(frameMax, frameNs_[i]);
+        workMax = std::max(workMax, workNs_[i]);
+    }
+
+    s.frames = numSampled_;
+    s.late = late_;
+    s.frameMs = frameSum / 1000000. / numSampled_;
+    s.frameMaxMs = frameMax / 1000000.;
+    s.workMs = workSum / 1000000. / numSampled_;
+    s.workMaxMs = workMax / 1000000.;
+    s.fps = s.frameMs > 0. ? 1000. / s.frameMs : 0.;
+
+    return s;
+}
@@ -0,0 +1,143 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <vector>
+
+#include <QObject>
+#include <QElapsedTimer>
+
+class QTimer;
+
+/** @brief Paces the frames of an animation.
+
+    <p>The renderer calls beginFrame() and endFrame() around each frame.
+    The scheduler then emits frameDue() when the next frame should start,
+    through a precise timer in the event loop, so input events are
+    handled between frames.</p>
+
+    <p>A target rate of 0 runs uncapped: the next frame is requested as
+    soon as the event loop is idle. A frame that finishes after the due
+    time of the next one starts the next one right away, missed frames
+    are dropped instead of being caught up. Frames that were not requested
+    by frameDue(), e.g. repaints for mouse input, do not move the due time
+    and are not part of the statistics.</p>
+
+    <p>All times come from a monotonic nanosecond clock.</p>
+*/
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+public:
+
+    /** Statistics over the last frames */
+    struct Stats
+    {
+        /** frames per second */
+        double fps;
+        /** time between the starts of two frames in milliseconds */
+        double frameMs, frameMaxMs;
+        /** time between beginFrame() and endFrame() in milliseconds */
+        double workMs, workMaxMs;
+        /** number of frames that missed their due time since start() */
+        int late;
+        /** number of frames the statistics are taken from */
+        int frames;
+
+        Stats() : fps(0.), frameMs(0.), frameMaxMs(0.),
+                  workMs(0.), workMaxMs(0.), late(0), frames(0) { }
+    };
+
+    explicit FrameScheduler(QObject * parent = 0);
+
+    // ----------- query ---------------------
+
+    /** The frame rate to pace to, 0 for uncapped */
+    double targetFps() const { return targetFps_; }
+
+    bool isRunning() const { return running_; }
+
+    /** The current frame was requested by frameDue().
+        Valid between beginFrame() and endFrame(). */
+    bool isScheduledFrame() const { return dueFrame_; }
+
+    /** Seconds since the clock was started with start() or restartClock() */
+    double time() const;
+
+    /** Returns the statistics of the last frames */
+    Stats stats() const;
+
+signals:
+
+    /** Emitted when the next frame should be rendered */
+    void frameDue();
+
+public slots:
+
+    /** Sets the frame rate, 0 for uncapped */
+    void setTargetFps(double fps);
+
+    /** Starts emitting frameDue() and restarts the statistics */
+    void start();
+
+    /** Stops emitting frameDue() */
+    void stop();
+
+    /** Sets time() to zero */
+    void restartClock();
+
+    /** Call when rendering of a frame starts */
+    void beginFrame();
+
+    /** Call when rendering of a frame is done.
+        Schedules the next frame when running. */
+    void endFrame();
+
+private slots:
+
+    void onTimeout_();
+
+private:
+
+    void clearStats_();
+
+    QElapsedTimer clock_, time_;
+    QTimer * timer_;
+
+    double targetFps_;
+    bool running_, inFrame_;
+    /** frameDue() was emitted and the frame has not begun yet,
+        the current frame was started by frameDue() */
+    bool due_, dueFrame_;
+
+    /** clock_ time of the next due frame,
+        the start of the current and the previous frame */
+    qint64 nextDue_, frameBegin_, lastBegin_;
+
+    // --- statistics ring buffer ---
+
+    static const int numSamples_ = 120;
+    std::vector<qint64> frameNs_, workNs_;
+    int sampleIndex_, numSampled_, late_;
+};
+
+#endif // FRAMESCHEDULER_H
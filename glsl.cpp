@@ -18,64 +18,191 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <cstring>
+#include <algorithm>
+
 #include <QDebug>
 #include <QStringList>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDir>
+#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
 
 #include "glsl.h"
 #include "debug.h"
 #include "appsettings.h"
-
-void privateUniformDeleter(Uniform * u) { delete u; }
-
+#include "programcache.h"
+#include "shadercompilethread.h"
 
 Uniform::Uniform()
     :   type_    (0),
         size_    (0),
-        location_(0)
+        location_(0),
+        block_   (-1),
+        offset_  (-1),
+        changed_ (true),
+        frozen_  (false)
 {
     floats[0] = floats[1] = floats[2] = floats[3] = 0.f;
     ints[0] = ints[1] = ints[2] = ints[3] = 0;
 }
 
-void Uniform::copyValuesFrom_(Uniform * u)
+void Uniform::copyValuesFrom_(const Uniform& u)
 {
-    floats[0] = u->floats[0];
-    floats[1] = u->floats[1];
-    floats[2] = u->floats[2];
-    floats[3] = u->floats[3];
-    ints[0] = u->ints[0];
-    ints[1] = u->ints[1];
-    ints[2] = u->ints[2];
-    ints[3] = u->ints[3];
+    floats[0] = u.floats[0];
+    floats[1] = u.floats[1];
+    floats[2] = u.floats[2];
+    floats[3] = u.floats[3];
+    ints[0] = u.ints[0];
+    ints[1] = u.ints[1];
+    ints[2] = u.ints[2];
+    ints[3] = u.ints[3];
 }
 
 
 Glsl::Glsl()
     :   shader_         (-1),
+        pendingProgram_ (0),
         sourceChanged_  (false),
         ready_          (false),
-        activated_      (false)
+        activated_      (false),
+        compiling_      (false),
+        succeeded_      (false),
+        pendingFromCache_(false),
+        pendingReused_  (false),
+        parallelCompile_(-1),
+        compileThread_  (0),
+        compileThreadFailed_(false),
+        compileTicket_  (0),
+        stageUseCount_  (0),
+        stagesCompiled_ (0),
+        stagesReused_   (0),
+        stageMsSaved_   (0.),
+        programsReused_ (0),
+        compileMs_      (0.),
+        linkMs_         (0.),
+        numUploads_     (0),
+        frameBlockIndex_(-1),
+        frameBlockBuffer_(0)
 #ifdef SCH_USE_QT_OPENGLFUNC
         ,isGlFuncInitialized_(false)
 #endif
 {
+    preprocessor_.setIncludePaths(appSettings->getValue("include_paths")
+                                  .toString().split(';', QString::SkipEmptyParts));
+
+    pendingStage_[0].shader = pendingStage_[1].shader = 0;
+    pendingStage_[0].cached = pendingStage_[1].cached = false;
+    pendingStage_[0].ms = pendingStage_[1].ms = 0.;
+}
+
+Glsl::~Glsl()
+{
+    delete compileThread_;
 }
 
 
-void Glsl::setVertexSource(const QString &text)
+void Glsl::setVertexSource(const QString &text, const QString& filename)
 {
     vertSource_ = text;
+    vertFile_ = filename;
     sourceChanged_ = true;
 }
 
-void Glsl::setFragmentSource(const QString &text)
+void Glsl::setFragmentSource(const QString &text, const QString& filename)
 {
     fragSource_ = text;
+    fragFile_ = filename;
     sourceChanged_ = true;
 }
 
+void Glsl::setDefines(const QStringList& defines)
+{
+    if (defines == defines_)
+        return;
+
+    defines_ = defines;
+    sourceChanged_ = true;
+}
+
+void Glsl::freezeUniforms()
+{
+    frozen_.clear();
+
+    for (auto i = uniforms_.begin(); i != uniforms_.end(); ++i)
+    {
+        // block members are shared with the buffer layout
+        if (i->block_ >= 0 || i->size_ != 1)
+            continue;
+
+        FrozenUniform f;
+        switch (i->type_)
+        {
+            case GL_FLOAT:      f.type = "float"; break;
+            case GL_FLOAT_VEC2: f.type = "vec2"; break;
+            case GL_FLOAT_VEC3: f.type = "vec3"; break;
+            case GL_FLOAT_VEC4: f.type = "vec4"; break;
+            case GL_INT:        f.type = "int"; break;
+            default: continue;
+        }
+        f.value = frozenValue_(*i);
+        f.uniform = *i;
+        frozen_.insert(i->name_, f);
+    }
+
+    sourceChanged_ = true;
+}
+
+void Glsl::unfreezeUniforms()
+{
+    if (frozen_.isEmpty())
+        return;
+
+    frozen_.clear();
+    sourceChanged_ = true;
+}
+
+QString Glsl::frozenValue_(const Uniform& u)
+{
+    // floats always need a decimal point or exponent
+    auto f = [&u](int i)
+    {
+        QString s = QString::number(u.floats[i], 'g', 9);
+        if (!s.contains('.') && !s.contains('e') && !s.contains('n'))
+            s += ".0";
+        return s;
+    };
+
+    switch (u.type_)
+    {
+        case GL_FLOAT:      return f(0);
+        case GL_FLOAT_VEC2: return QString("vec2(%1, %2)").arg(f(0)).arg(f(1));
+        case GL_FLOAT_VEC3: return QString("vec3(%1, %2, %3)").arg(f(0)).arg(f(1)).arg(f(2));
+        case GL_FLOAT_VEC4: return QString("vec4(%1, %2, %3, %4)")
+                                    .arg(f(0)).arg(f(1)).arg(f(2)).arg(f(3));
+        case GL_INT:        return QString::number(u.ints[0]);
+    }
+    return QString();
+}
+
 
 bool Glsl::compile()
+{
+    if (!beginCompile_(true))
+        return false;
+
+    // blocks until the driver is done
+    return finishCompile_();
+}
+
+bool Glsl::beginCompile()
+{
+    return beginCompile_(false);
+}
+
+bool Glsl::beginCompile_(bool wait)
 {
 
 #ifdef SCH_USE_QT_OPENGLFUNC
@@ -86,82 +213,509 @@ bool Glsl::compile()
     }
 #endif
 
+    // a newer source replaces an unfinished compile
+    cancelCompile();
+
     // init state
-    ready_ = false;
     sourceChanged_ = false;
+    succeeded_ = false;
     log_ = "";
-    uniforms_.clear();
+    pendingCacheKey_.clear();
+    pendingFromCache_ = false;
+    pendingReused_ = false;
+    compileMs_ = linkMs_ = 0.;
+
+    if (!preprocess_())
+        return false;
+
+    // see if this variant was linked before
+    pendingProgramKey_ = makeProgramKey_();
+    auto linked = linkedCache_.find(pendingProgramKey_);
+    if (linked != linkedCache_.end())
+    {
+        // (the program leaves the cache while in use)
+        pendingProgram_ = linked.value().program;
+        linkedCache_.erase(linked);
+
+        pendingReused_ = true;
+        ++programsReused_;
+        log_ += QString("linked program reused (%1 times so far)\n").arg(programsReused_);
 
-    // delete previous shader object
-    SCH_CHECK_GL( if (glIsProgram(shader_)) glDeleteProgram(shader_) );
+        compiling_ = true;
+        return true;
+    }
 
-    // create shader object
-    SCH_CHECK_GL( shader_ = glCreateProgram() );
+    // create the new program object,
+    // the current one stays in use until this one is linked
+    SCH_CHECK_GL( pendingProgram_ = glCreateProgram() );
 
     // test if working
-    if (!glIsProgram(shader_))
+    if (!glIsProgram(pendingProgram_))
     {
         log_ += "could not create ProgramObject\n";
+        pendingProgram_ = 0;
         return false;
     }
 
-    // compile the vertex shader
-    if (!compileShader_(GL_VERTEX_SHADER, "vertex shader", vertSource_))
+    bindAttribLocations_(pendingProgram_);
+
+    // try the program binary cache first
+    if (programCache && hasProgramBinary_())
     {
-        return false;
+        const QString driver = QString("%1 %2 %3")
+                .arg((const char*)glGetString(GL_VENDOR))
+                .arg((const char*)glGetString(GL_RENDERER))
+                .arg((const char*)glGetString(GL_VERSION));
+
+        pendingCacheKey_ = ProgramCache::makeKey(vertExpanded_, fragExpanded_,
+                                                 attributeBindings_(), driver);
+
+        pendingFromCache_ = loadProgramBinary_(pendingCacheKey_);
+
+        if (pendingFromCache_)
+        {
+            compiling_ = true;
+            return true;
+        }
     }
 
-    // compile the fragment shader
-    if (!compileShader_(GL_FRAGMENT_SHADER, "fragment shader", fragSource_))
+    // without driver-side parallel compile,
+    // compile and link on a thread, so the frames go on
+    ShaderCompileThread * thread = (wait || hasParallelCompile_())
+            ? 0 : getCompileThread_();
+
+    // create the vertex and fragment shader, with parallel compile in the
+    // driver start compiling them right away, otherwise see below
+    // (unchanged sources are taken from the shader object cache)
+    const bool compileNow = !wait && !thread;
+    compileShader_(GL_VERTEX_SHADER, "vertex shader", vertExpanded_, pendingStage_[0], compileNow);
+    compileShader_(GL_FRAGMENT_SHADER, "fragment shader", fragExpanded_, pendingStage_[1], compileNow);
+    if (!pendingStage_[0].shader || !pendingStage_[1].shader)
+    {
+        cancelCompile();
         return false;
+    }
+
+    if (thread)
+    {
+#ifdef SCH_HAS_PROGRAM_BINARY
+        if (!pendingCacheKey_.isEmpty())
+            SCH_CHECK_GL( glProgramParameteri(pendingProgram_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE) );
+#endif
+        // the thread's context must see the sources and attachments
+        SCH_CHECK_GL( glFlush() );
+
+        compileTicket_ = thread->compile(pendingProgram_,
+                pendingStage_[0].cached ? 0 : pendingStage_[0].shader,
+                pendingStage_[1].cached ? 0 : pendingStage_[1].shader);
+        compiling_ = true;
+        return true;
+    }
+
+    // querying the status waits for the driver,
+    // so each stage and the link are timed on their own
+    QElapsedTimer timer;
+    GLint status;
+    if (wait)
+        for (int i=0; i<2; ++i)
+            if (!pendingStage_[i].cached)
+            {
+                timer.start();
+                SCH_CHECK_GL( glCompileShader(pendingStage_[i].shader) );
+                SCH_CHECK_GL( glGetShaderiv(pendingStage_[i].shader, GL_COMPILE_STATUS, &status) );
+                pendingStage_[i].ms = timer.nsecsElapsed() / 1000000.;
+                compileMs_ += pendingStage_[i].ms;
+            }
+    timer.start();
+
+#ifdef SCH_HAS_PROGRAM_BINARY
+    if (!pendingCacheKey_.isEmpty())
+        SCH_CHECK_GL( glProgramParameteri(pendingProgram_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE) );
+#endif
 
     // link program object
-    SCH_CHECK_GL( glLinkProgram(shader_) );
+    // (with parallel compile this returns immediately)
+    SCH_CHECK_GL( glLinkProgram(pendingProgram_) );
+
+    if (wait)
+        SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_LINK_STATUS, &status) );
+    linkMs_ = timer.nsecsElapsed() / 1000000.;
+
+    compiling_ = true;
+    return true;
+}
+
+bool Glsl::preprocess_()
+{
+    dependencies_.clear();
+    switches_.clear();
+    valueDefines_.clear();
+
+    if (!defines_.isEmpty())
+        log_ += "variant: " + defines_.join(' ') + "\n";
+    if (!frozen_.isEmpty())
+        log_ += QString("%1 uniforms frozen\n").arg(frozen_.size());
+
+    // vertex shader
+    vertExpanded_ = preprocessor_.process(vertSource_, vertFile_);
+    if (!preprocessor_.log().isEmpty())
+        log_ += "vertex shader preprocessor:\n" + preprocessor_.log();
+    if (!preprocessor_.dependencies().isEmpty())
+        log_ += "vertex shader includes:\n" + preprocessor_.sourceNumberLegend();
+    dependencies_ += preprocessor_.dependencies();
+    const bool vertOk = vertSource_.isEmpty() || !vertExpanded_.isEmpty();
+
+    // fragment shader
+    fragExpanded_ = preprocessor_.process(fragSource_, fragFile_);
+    if (!preprocessor_.log().isEmpty())
+        log_ += "fragment shader preprocessor:\n" + preprocessor_.log();
+    if (!preprocessor_.dependencies().isEmpty())
+        log_ += "fragment shader includes:\n" + preprocessor_.sourceNumberLegend();
+    dependencies_ += preprocessor_.dependencies();
+    const bool fragOk = fragSource_.isEmpty() || !fragExpanded_.isEmpty();
+
+    findSwitches_(vertExpanded_);
+    findSwitches_(fragExpanded_);
+    // (a name might be found as value only in the second source)
+    for (auto i = valueDefines_.begin(); i != valueDefines_.end(); ++i)
+        switches_.removeAll(i.key());
+    switches_.removeDuplicates();
+    switches_.sort();
+
+    frozenApplied_.clear();
+    applyFrozen_(vertExpanded_);
+    applyFrozen_(fragExpanded_);
+
+    applyDefines_(vertExpanded_);
+    applyDefines_(fragExpanded_);
+
+    return vertOk && fragOk;
+}
+
+void Glsl::applyDefines_(QString& source) const
+{
+    if (defines_.isEmpty() || source.isEmpty())
+        return;
+
+    QString lines;
+    for (auto i = defines_.begin(); i != defines_.end(); ++i)
+    {
+        const int eq = i->indexOf('=');
+        if (eq < 0)
+            lines += "#define " + *i + "\n";
+        else
+            lines += "#define " + i->left(eq) + " " + i->mid(eq + 1) + "\n";
+    }
+
+    // defines must follow the #version directive
+    static const QRegularExpression version("^[ \\t]*#[ \\t]*version[^\\n]*\\n?",
+                                            QRegularExpression::MultilineOption);
+    int pos = 0;
+    const QRegularExpressionMatch m = version.match(source);
+    if (m.hasMatch())
+    {
+        pos = m.capturedEnd();
+        if (source.at(pos - 1) != '\n')
+            lines.prepend('\n');
+    }
+
+    // keep the line numbers of the original source
+    const int line = source.leftRef(pos).count('\n') + 1;
+    lines += QString("#line %1 0\n").arg(line);
+
+    source.insert(pos, lines);
+}
+
+void Glsl::applyFrozen_(QString& source)
+{
+    if (frozen_.isEmpty())
+        return;
+
+    static const QRegularExpression decl(
+            "^([ \\t]*)uniform[ \\t]+(?:(?:lowp|mediump|highp)[ \\t]+)?(\\w+)[ \\t]+(\\w+)[ \\t]*;",
+            QRegularExpression::MultilineOption);
+
+    // replace from the back, so the positions stay valid
+    std::vector<QRegularExpressionMatch> matches;
+    auto i = decl.globalMatch(source);
+    while (i.hasNext())
+        matches.push_back(i.next());
+
+    for (auto m = matches.rbegin(); m != matches.rend(); ++m)
+    {
+        auto f = frozen_.find(m->captured(3));
+        if (f == frozen_.end() || f.value().type != m->captured(2))
+            continue;
+
+        // (on the same line to keep the line numbers)
+        source.replace(m->capturedStart(), m->capturedLength(),
+                       QString("%1const %2 %3 = %4;")
+                       .arg(m->captured(1)).arg(f.value().type)
+                       .arg(f.key()).arg(f.value().value));
+        frozenApplied_.insert(f.key());
+    }
+}
+
+void Glsl::findSwitches_(const QString& source)
+{
+    static const QRegularExpression
+        tested      ("^[ \\t]*#[ \\t]*ifn?def[ \\t]+(\\w+)",
+                     QRegularExpression::MultilineOption),
+        conditional ("^[ \\t]*#[ \\t]*(?:if|elif)\\b([^\\n]*)",
+                     QRegularExpression::MultilineOption),
+        defined     ("\\bdefined[ \\t]*\\(?[ \\t]*(\\w+)[ \\t]*\\)?"),
+        identifier  ("\\b[A-Za-z_]\\w*"),
+        define      ("^[ \\t]*#[ \\t]*define[ \\t]+(\\w+)",
+                     QRegularExpression::MultilineOption),
+        // #ifndef NAME / #define NAME value, a default that can be overridden
+        defaulted   ("^[ \\t]*#[ \\t]*ifndef[ \\t]+(\\w+)[ \\t]*\\n"
+                     "[ \\t]*#[ \\t]*define[ \\t]+\\1[ \\t]+([^\\n]*\\S)",
+                     QRegularExpression::MultilineOption);
+
+    QStringList names, valued;
+    QSet<QString> own;
+
+    auto i = tested.globalMatch(source);
+    while (i.hasNext())
+        names << i.next().captured(1);
+
+    i = conditional.globalMatch(source);
+    while (i.hasNext())
+    {
+        QString expr = i.next().captured(1);
+        auto j = defined.globalMatch(expr);
+        while (j.hasNext())
+            names << j.next().captured(1);
+
+        // what's left are values, e.g. #if STEPS > 64
+        expr.remove(defined);
+        const int comment = expr.indexOf("//");
+        if (comment >= 0)
+            expr.truncate(comment);
+        j = identifier.globalMatch(expr);
+        while (j.hasNext())
+            valued << j.next().captured(0);
+    }
+
+    // header guards and such
+    i = define.globalMatch(source);
+    while (i.hasNext())
+        own.insert(i.next().captured(1));
+
+    auto isUsable = [&](const QString& n)
+    {
+        return !own.contains(n) && !n.startsWith("GL_") && !n.startsWith("__");
+    };
+
+    for (auto n = valued.begin(); n != valued.end(); ++n)
+        if (isUsable(*n) && !valueDefines_.contains(*n))
+            valueDefines_.insert(*n, QString());
+
+    i = defaulted.globalMatch(source);
+    while (i.hasNext())
+    {
+        auto m = i.next();
+        if (m.captured(1).startsWith("GL_") || m.captured(1).startsWith("__"))
+            continue;
+        QString value = m.captured(2);
+        const int comment = value.indexOf("//");
+        if (comment >= 0)
+            value.truncate(comment);
+        valueDefines_.insert(m.captured(1), value.trimmed());
+    }
+
+    for (auto n = names.begin(); n != names.end(); ++n)
+        if (isUsable(*n) && !valueDefines_.contains(*n))
+            switches_ << *n;
+}
+
+bool Glsl::dependsOn(const QString& filename) const
+{
+    return dependencies_.contains(QDir::cleanPath(QFileInfo(filename).absoluteFilePath()));
+}
+
+void Glsl::fileChanged(const QString& filename)
+{
+    preprocessor_.fileChanged(filename);
+    sourceChanged_ = true;
+}
+
+bool Glsl::pollCompile()
+{
+    if (!compiling_)
+        return true;
+
+    if (compileTicket_)
+    {
+        ShaderCompileThread::Result res;
+        if (!compileThread_->take(compileTicket_, res))
+            return false;
+        compileTicket_ = 0;
+        for (int i=0; i<2; ++i)
+            pendingStage_[i].ms = res.compileMs[i];
+        compileMs_ = res.compileMs[0] + res.compileMs[1];
+        linkMs_ = res.linkMs;
+    }
+    // ask the driver without blocking
+    else if (hasParallelCompile_())
+    {
+        GLint done = GL_TRUE;
+        SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_COMPLETION_STATUS_KHR, &done) );
+        if (!done)
+            return false;
+    }
+
+    finishCompile_();
+    return true;
+}
+
+void Glsl::cancelCompile()
+{
+    // objects still in use by the compile thread are deleted there
+    if (compileTicket_)
+    {
+        if (compileThread_->discard(compileTicket_))
+        {
+            for (int i=0; i<2; ++i)
+                if (!pendingStage_[i].cached)
+                    pendingStage_[i].shader = 0;
+            pendingProgram_ = 0;
+        }
+        compileTicket_ = 0;
+    }
+
+    for (int i=0; i<2; ++i)
+    {
+        // cached shader objects are still needed
+        if (pendingStage_[i].shader && !pendingStage_[i].cached)
+            SCH_CHECK_GL( glDeleteShader(pendingStage_[i].shader) );
+        pendingStage_[i].shader = 0;
+    }
+
+    if (pendingProgram_)
+    {
+        // a reused variant goes back to the cache
+        if (pendingReused_)
+            storeLinked_(pendingProgramKey_, pendingProgram_);
+        else
+            SCH_CHECK_GL( glDeleteProgram(pendingProgram_) );
+        pendingProgram_ = 0;
+    }
+
+    compiling_ = false;
+}
+
+bool Glsl::finishCompile_()
+{
+    compiling_ = false;
+
+    // check the shaders
+    bool compiled = true;
+    if (!pendingFromCache_ && !pendingReused_)
+    {
+        compiled &= checkShader_(pendingStage_[0], "vertex shader");
+        compiled &= checkShader_(pendingStage_[1], "fragment shader");
+
+        log_ += QString("shader object cache: %1 compiled, %2 reused, %3 ms saved\n")
+                .arg(stagesCompiled_).arg(stagesReused_).arg(stageMsSaved_, 0, 'f', 1);
+    }
 
     GLint linked;
-    SCH_CHECK_GL( glGetProgramiv(shader_, GL_LINK_STATUS, &linked) );
+    SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_LINK_STATUS, &linked) );
     if (!linked)
     {
         log_ += "shader programm link error\n";
-        shader_ = -1;
     }
 
     // print linker log
     GLint blen = 0;
     GLsizei slen = 0;
-    SCH_CHECK_GL( glGetProgramiv(shader_, GL_INFO_LOG_LENGTH , &blen) );
+    SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_INFO_LOG_LENGTH , &blen) );
     if (blen > 1)
     {
         std::vector<GLchar> compiler_log(blen+1);
-        SCH_CHECK_GL( glGetProgramInfoLog(shader_, blen, &slen, &compiler_log[0]) );
+        SCH_CHECK_GL( glGetProgramInfoLog(pendingProgram_, blen, &slen, &compiler_log[0]) );
         log_ += "linker log:\n" + QString(&compiler_log[0]) + "\n";
     }
 
-
-    if (!linked)
+    if (!compiled || !linked)
+    {
+        cancelCompile();
+        if (ready_)
+            log_ += "keeping previous program\n";
         return false;
+    }
+
+    if (!pendingFromCache_ && !pendingCacheKey_.isEmpty())
+        storeProgramBinary_(pendingCacheKey_);
+
+    // shader objects are not needed by the program after linking
+    // (they live on in the cache)
+    for (int i=0; i<2; ++i)
+    if (pendingStage_[i].shader)
+    {
+        SCH_CHECK_GL( glDetachShader(pendingProgram_, pendingStage_[i].shader) );
+        pendingStage_[i].shader = 0;
+    }
+
+    // exchange programs
+    // (the previous one is kept for switching back)
+    if (ready_)
+        storeLinked_(programKey_, shader_);
+    shader_ = pendingProgram_;
+    programKey_ = pendingProgramKey_;
+    pendingProgram_ = 0;
 
     getSpecialLocations_();
-    getUniforms_();
 
-    // keep copy of previous uniforms
-    oldUniforms_ = uniforms_;
+    getUniformBlocks_();
 
+    // keep previous uniforms
+    // (the uniform widgets still point to them)
+    oldUniforms_.swap(uniforms_);
+    getUniforms_();
+
+    succeeded_ = true;
     return ready_ = true;
 }
 
 
-bool Glsl::compileShader_(GLenum type, const QString& typeName, const QString &source)
+GLuint Glsl::compileShader_(GLenum type, const QString& typeName, const QString &source,
+                            Stage& stage, bool compile)
 {
+    stage.shader = 0;
+    stage.cached = false;
+    stage.ms = 0.;
+
     if (source.isEmpty())
-        return false;
+    {
+        log_ += typeName + " source is empty\n";
+        return 0;
+    }
+
+    // see if we compiled that before
+    stage.key = stageKey_(type, source);
+    auto cached = stageCache_.find(stage.key);
+    if (cached != stageCache_.end())
+    {
+        cached.value().lastUse = ++stageUseCount_;
+        stage.shader = cached.value().shader;
+        stage.cached = true;
 
-    int shadername;
+        ++stagesReused_;
+        stageMsSaved_ += cached.value().ms;
+        log_ += typeName + " reused..\n";
+
+        SCH_CHECK_GL( glAttachShader(pendingProgram_, stage.shader) );
+        return stage.shader;
+    }
+
+    GLuint shadername;
     SCH_CHECK_GL( shadername = glCreateShader(type) );
     if (!glIsShader(shadername))
     {
         log_ += "error creating " + typeName + " ShaderObject\n";
-        return false;
+        return 0;
     }
 
     // get the latin1 char source
@@ -178,7 +732,22 @@ bool Glsl::compileShader_(GLenum type, const QString& typeName, const QString &s
     // attach source
     SCH_CHECK_GL( glShaderSource(shadername, 1, psrc, 0) );
     // compile
-    SCH_CHECK_GL( glCompileShader(shadername) );
+    if (compile)
+        SCH_CHECK_GL( glCompileShader(shadername) );
+
+    // attach to programObject
+    SCH_CHECK_GL( glAttachShader(pendingProgram_, shadername) );
+
+    return stage.shader = shadername;
+}
+
+bool Glsl::checkShader_(Stage& stage, const QString& typeName)
+{
+    // result is known already
+    if (stage.cached)
+        return true;
+
+    const GLuint shadername = stage.shader;
 
     // check compile status
     bool compiled = false;
@@ -206,12 +775,100 @@ bool Glsl::compileShader_(GLenum type, const QString& typeName, const QString &s
         // error_line_(compiler_log, code));
     }
 
-    // attach to programObject
-    SCH_CHECK_GL( glAttachShader(shader_, shadername) );
+    // keep successfully compiled shaders for reuse,
+    // even if the program does not link
+    if (compiled)
+    {
+        ++stagesCompiled_;
+        storeStage_(stage.key, shadername, stage.ms);
+        stage.cached = true;
+    }
 
     return compiled;
 }
 
+QByteArray Glsl::stageKey_(GLenum type, const QString& source)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(source.toUtf8());
+    return QByteArray::number(type) + ":" + hash.result();
+}
+
+void Glsl::storeStage_(const QByteArray& key, GLuint shader, double ms)
+{
+    CachedStage c;
+    c.shader = shader;
+    c.ms = ms;
+    c.lastUse = ++stageUseCount_;
+    stageCache_.insert(key, c);
+
+    // remove least recently used
+    while (stageCache_.size() > maxCachedStages_)
+    {
+        auto lru = stageCache_.begin();
+        for (auto i = stageCache_.begin(); i != stageCache_.end(); ++i)
+            if (i.value().lastUse < lru.value().lastUse)
+                lru = i;
+
+        // (shaders that are still attached are deleted on detach)
+        SCH_CHECK_GL( glDeleteShader(lru.value().shader) );
+        stageCache_.erase(lru);
+    }
+}
+
+void Glsl::clearStageCache_()
+{
+    for (auto i = stageCache_.begin(); i != stageCache_.end(); ++i)
+        SCH_CHECK_GL( glDeleteShader(i.value().shader) );
+    stageCache_.clear();
+}
+
+QByteArray Glsl::makeProgramKey_() const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(vertExpanded_.toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(fragExpanded_.toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(attributeBindings_().toUtf8());
+    return hash.result();
+}
+
+void Glsl::storeLinked_(const QByteArray& key, GLuint program)
+{
+    // same sources compiled twice
+    auto existing = linkedCache_.find(key);
+    if (existing != linkedCache_.end())
+    {
+        SCH_CHECK_GL( glDeleteProgram(existing.value().program) );
+        linkedCache_.erase(existing);
+    }
+
+    LinkedProgram p;
+    p.program = program;
+    p.lastUse = ++stageUseCount_;
+    linkedCache_.insert(key, p);
+
+    // remove least recently used
+    while (linkedCache_.size() > maxLinkedPrograms_)
+    {
+        auto lru = linkedCache_.begin();
+        for (auto i = linkedCache_.begin(); i != linkedCache_.end(); ++i)
+            if (i.value().lastUse < lru.value().lastUse)
+                lru = i;
+
+        SCH_CHECK_GL( glDeleteProgram(lru.value().program) );
+        linkedCache_.erase(lru);
+    }
+}
+
+void Glsl::clearLinkedCache_()
+{
+    for (auto i = linkedCache_.begin(); i != linkedCache_.end(); ++i)
+        SCH_CHECK_GL( glDeleteProgram(i.value().program) );
+    linkedCache_.clear();
+}
+
 
 void Glsl::activate()
 {
@@ -219,6 +876,10 @@ void Glsl::activate()
         return;
 
     SCH_CHECK_GL( glUseProgram(shader_) );
+
+    for (auto i = blocks_.begin(); i != blocks_.end(); ++i)
+        SCH_CHECK_GL( glBindBufferBase(GL_UNIFORM_BUFFER, i->binding, i->buffer) );
+
     activated_ = true;
 }
 
@@ -231,28 +892,164 @@ void Glsl::deactivate()
     activated_ = false;
 }
 
+void Glsl::bindAttribLocations_(GLuint program)
+{
+    const AppSettings::ShaderNames& n = appSettings->shaderNames();
+
+    // takes effect on the next link
+    SCH_CHECK_GL( glBindAttribLocation(program, SCH_ATTRIB_POSITION, n.position.constData()) );
+    SCH_CHECK_GL( glBindAttribLocation(program, SCH_ATTRIB_NORMAL, n.normal.constData()) );
+    SCH_CHECK_GL( glBindAttribLocation(program, SCH_ATTRIB_COLOR, n.color.constData()) );
+    SCH_CHECK_GL( glBindAttribLocation(program, SCH_ATTRIB_TEXCOORD, n.texcoord.constData()) );
+}
+
+QString Glsl::attributeBindings_() const
+{
+    const AppSettings::ShaderNames& n = appSettings->shaderNames();
+
+    return QString("%1=%2 %3=%4 %5=%6 %7=%8")
+            .arg(QString(n.position)).arg(SCH_ATTRIB_POSITION)
+            .arg(QString(n.normal)).arg(SCH_ATTRIB_NORMAL)
+            .arg(QString(n.color)).arg(SCH_ATTRIB_COLOR)
+            .arg(QString(n.texcoord)).arg(SCH_ATTRIB_TEXCOORD);
+}
+
+bool Glsl::hasExtension_(const char * name)
+{
+    GLint num = 0;
+    SCH_CHECK_GL( glGetIntegerv(GL_NUM_EXTENSIONS, &num) );
+    for (GLint i=0; i<num; ++i)
+        if (!strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name))
+            return true;
+    return false;
+}
+
+bool Glsl::hasParallelCompile_()
+{
+    // query once
+    if (parallelCompile_ < 0)
+        parallelCompile_ = hasExtension_("GL_KHR_parallel_shader_compile")
+                        || hasExtension_("GL_ARB_parallel_shader_compile");
+    return parallelCompile_;
+}
+
+ShaderCompileThread * Glsl::getCompileThread_()
+{
+    if (compileThread_ || compileThreadFailed_)
+        return compileThread_;
+
+    // try once
+    compileThreadFailed_ = true;
+
+    QOpenGLContext * share = QOpenGLContext::currentContext();
+    if (!share)
+        return 0;
+
+    compileThread_ = new ShaderCompileThread(share);
+    if (!compileThread_->isValid())
+    {
+        log_ += "could not create a shared context for the compile thread\n";
+        delete compileThread_;
+        return compileThread_ = 0;
+    }
+
+    compileThreadFailed_ = false;
+    return compileThread_;
+}
+
+bool Glsl::hasProgramBinary_()
+{
+#ifdef SCH_HAS_PROGRAM_BINARY
+    // core since 4.1
+    GLint major = 0, minor = 0;
+    SCH_CHECK_GL( glGetIntegerv(GL_MAJOR_VERSION, &major) );
+    SCH_CHECK_GL( glGetIntegerv(GL_MINOR_VERSION, &minor) );
+    const bool supported = major > 4 || (major == 4 && minor >= 1)
+                        || hasExtension_("GL_ARB_get_program_binary");
+    if (!supported)
+        return false;
+
+    // some drivers support the api but no formats
+    GLint numFormats = 0;
+    SCH_CHECK_GL( glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats) );
+    return numFormats > 0;
+#else
+    return false;
+#endif
+}
+
+bool Glsl::loadProgramBinary_(const QByteArray& key)
+{
+#ifdef SCH_HAS_PROGRAM_BINARY
+    unsigned int format;
+    QByteArray binary;
+    if (!programCache->load(key, format, binary))
+        return false;
+
+    SCH_CHECK_GL( glProgramBinary(pendingProgram_, format, binary.constData(), binary.size()) );
+
+    GLint linked;
+    SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_LINK_STATUS, &linked) );
+    if (linked)
+    {
+        log_ += "program loaded from cache\n";
+        return true;
+    }
+
+    // driver update or such
+    log_ += "cached program binary rejected\n";
+    programCache->remove(key);
+
+    // start over with a fresh program
+    SCH_CHECK_GL( glDeleteProgram(pendingProgram_) );
+    SCH_CHECK_GL( pendingProgram_ = glCreateProgram() );
+    bindAttribLocations_(pendingProgram_);
+#else
+    Q_UNUSED(key);
+#endif
+    return false;
+}
+
+void Glsl::storeProgramBinary_(const QByteArray& key)
+{
+#ifdef SCH_HAS_PROGRAM_BINARY
+    GLint length = 0;
+    SCH_CHECK_GL( glGetProgramiv(pendingProgram_, GL_PROGRAM_BINARY_LENGTH, &length) );
+    if (length <= 0)
+        return;
+
+    QByteArray binary(length, 0);
+    GLenum format;
+    GLsizei written = 0;
+    SCH_CHECK_GL( glGetProgramBinary(pendingProgram_, length, &written, &format, binary.data()) );
+    if (written <= 0)
+        return;
+
+    binary.resize(written);
+    programCache->store(key, format, binary);
+#else
+    Q_UNUSED(key);
+#endif
+}
+
 void Glsl::getSpecialLocations_()
 {
-    SCH_CHECK_GL( attribs_.position = glGetAttribLocation(shader_,
-                    appSettings->getValue("ShaderAttributes/position").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.normal = glGetAttribLocation(shader_,
-                    appSettings->getValue("ShaderAttributes/normal").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.color = glGetAttribLocation(shader_,
-                    appSettings->getValue("ShaderAttributes/color").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.texcoord = glGetAttribLocation(shader_,
-                    appSettings->getValue("ShaderAttributes/texcoord").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.projection = glGetUniformLocation(shader_,
-                    appSettings->getValue("ShaderUniforms/projection").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.view = glGetUniformLocation(shader_,
-                    appSettings->getValue("ShaderUniforms/view").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.time = glGetUniformLocation(shader_,
-                    appSettings->getValue("ShaderUniforms/time").toString().toStdString().c_str()) );
-    SCH_CHECK_GL( attribs_.aspect = glGetUniformLocation(shader_,
-                    appSettings->getValue("ShaderUniforms/aspect").toString().toStdString().c_str()) );
+    const AppSettings::ShaderNames& n = appSettings->shaderNames();
+
+    SCH_CHECK_GL( attribs_.position = glGetAttribLocation(shader_, n.position.constData()) );
+    SCH_CHECK_GL( attribs_.normal = glGetAttribLocation(shader_, n.normal.constData()) );
+    SCH_CHECK_GL( attribs_.color = glGetAttribLocation(shader_, n.color.constData()) );
+    SCH_CHECK_GL( attribs_.texcoord = glGetAttribLocation(shader_, n.texcoord.constData()) );
+    SCH_CHECK_GL( attribs_.projection = glGetUniformLocation(shader_, n.projection.constData()) );
+    SCH_CHECK_GL( attribs_.view = glGetUniformLocation(shader_, n.view.constData()) );
+    SCH_CHECK_GL( attribs_.time = glGetUniformLocation(shader_, n.time.constData()) );
+    SCH_CHECK_GL( attribs_.aspect = glGetUniformLocation(shader_, n.aspect.constData()) );
 }
 
 void Glsl::getUniforms_()
 {
+    const AppSettings::ShaderNames& names = appSettings->shaderNames();
+
     // get number of used uniforms
     GLint numu;
     SCH_CHECK_GL( glGetProgramiv(shader_, GL_ACTIVE_UNIFORMS, &numu) );
@@ -261,43 +1058,113 @@ void Glsl::getUniforms_()
     GLint labelLength;
     SCH_CHECK_GL( glGetProgramiv(shader_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &labelLength) );
 
-    // don't expose these to user
-    QStringList specialUniforms = appSettings->getShaderUniforms();
+    uniforms_.clear();
+    numu = std::max(0, numu);
 
-    // get each uniform data
+    // addresses must not change after this
+    uniforms_.reserve(numu + frozen_.size());
+
+    // query the properties of all uniforms at once
+    std::vector<GLuint> indices(numu);
+    std::vector<GLint>
+            types(numu), sizes(numu),
+            blockIndex(numu, -1), blockOffset(numu, -1);
     for (int i=0; i<numu; ++i)
+        indices[i] = i;
+    if (numu > 0)
     {
-        Uniform * u = new Uniform;
+        SCH_CHECK_GL( glGetActiveUniformsiv(shader_, numu, &indices[0], GL_UNIFORM_TYPE, &types[0]) );
+        SCH_CHECK_GL( glGetActiveUniformsiv(shader_, numu, &indices[0], GL_UNIFORM_SIZE, &sizes[0]) );
+        SCH_CHECK_GL( glGetActiveUniformsiv(shader_, numu, &indices[0], GL_UNIFORM_BLOCK_INDEX, &blockIndex[0]) );
+        SCH_CHECK_GL( glGetActiveUniformsiv(shader_, numu, &indices[0], GL_UNIFORM_OFFSET, &blockOffset[0]) );
+    }
+
+    // previous uniforms by name, to carry over the values
+    QHash<QString, const Uniform*> previous;
+    previous.reserve(oldUniforms_.size());
+    for (auto j = oldUniforms_.begin(); j!=oldUniforms_.end(); ++j)
+        previous.insert(j->name_, &*j);
+
+    // block index -> index into blocks_
+    QHash<GLint, int> blockMap;
+    for (size_t j=0; j<blocks_.size(); ++j)
+        blockMap.insert(blocks_[j].index, j);
 
+    std::vector<GLchar> name(labelLength + 1);
+
+    // get each uniform data
+    for (int i=0; i<numu; ++i)
+    {
         // plain old char* strings always need a bit of extra code ..
-        GLsizei length;
-        std::vector<GLchar> name(labelLength);
-        SCH_CHECK_GL(
-            glGetActiveUniform(shader_, i, name.size(), &length, &u->size_, &u->type_, &name[0])
-            );
-        name.resize(length);
-        u->name_ = QString(&name[0]);
+        GLsizei length = 0;
+        SCH_CHECK_GL( glGetActiveUniformName(shader_, i, name.size(), &length, &name[0]) );
+        name[length] = 0;
 
-        // discard for special uniforms from the user-interface
-        if (specialUniforms.contains(u->name_))
+        // members of the frame block are filled by the renderer
+        if (blockIndex[i] >= 0 && blockIndex[i] == frameBlockIndex_)
         {
-            delete u;
+            // (member names may be prefixed with the block name)
+            const char * dot = strrchr(&name[0], '.');
+            const QByteArray member(dot ? dot + 1 : &name[0]);
+            if (member == names.projection)
+                frameBlock_.projection = blockOffset[i];
+            else if (member == names.view)
+                frameBlock_.view = blockOffset[i];
+            else if (member == names.time)
+                frameBlock_.time = blockOffset[i];
+            else if (member == names.aspect)
+                frameBlock_.aspect = blockOffset[i];
             continue;
         }
 
-        // find location of uniform
-        SCH_CHECK_GL( u->location_ = glGetUniformLocation(shader_, &name[0]) );
+        Uniform u;
+        u.name_ = QString(&name[0]);
+        u.type_ = types[i];
+        u.size_ = sizes[i];
 
-        // keep in list
-        uniforms_.push_back(std::shared_ptr<Uniform>(u, privateUniformDeleter));
+        // discard for special uniforms from the user-interface
+        if (names.uniforms.contains(u.name_))
+            continue;
 
-        // see if we have values from previous uniforms
-        for (auto j = oldUniforms_.begin(); j!=oldUniforms_.end(); ++j)
-        if (j->get()->name_ == u->name_ && j->get()->type_ == u->type_)
+        if (blockIndex[i] >= 0)
         {
-            u->copyValuesFrom_(j->get());
-            break;
+            u.block_ = blockMap.value(blockIndex[i], -1);
+            u.offset_ = blockOffset[i];
+            u.location_ = -1;
         }
+        else
+            // find location of uniform
+            SCH_CHECK_GL( u.location_ = glGetUniformLocation(shader_, &name[0]) );
+
+        // see if we have values from previous uniforms
+        const Uniform * prev = previous.value(u.name_, 0);
+        if (prev && prev->type_ == u.type_)
+            u.copyValuesFrom_(*prev);
+
+        // keep in list
+        // (new program, so it needs to be send in any case)
+        u.changed_ = true;
+        uniforms_.push_back(u);
+    }
+
+    // frozen uniforms are constants in the program now,
+    // but stay editable for re-freezing
+    for (auto f = frozen_.begin(); f != frozen_.end(); ++f)
+    {
+        // not declared in this source
+        if (!frozenApplied_.contains(f.key()))
+            continue;
+
+        Uniform u = f.value().uniform;
+
+        const Uniform * prev = previous.value(u.name_, 0);
+        if (prev && prev->type_ == u.type_)
+            u.copyValuesFrom_(*prev);
+
+        u.location_ = -1;
+        u.frozen_ = true;
+        u.changed_ = false;
+        uniforms_.push_back(u);
     }
 }
 
@@ -329,12 +1196,191 @@ void Glsl::sendUniform(const Uniform * u)
 
 void Glsl::sendUniforms()
 {
-    for (size_t i=0; i<numUniforms(); ++i)
-        sendUniform(getUniform(i));
+    // the program keeps the values,
+    // so only changes need to be send
+    numUploads_ = 0;
+    for (auto i = uniforms_.begin(); i != uniforms_.end(); ++i)
+    if (i->changed_)
+    {
+        i->changed_ = false;
+
+        // compiled into the program
+        if (i->frozen_)
+            continue;
+
+        if (i->block_ >= 0)
+            writeBlockUniform_(*i);
+        else
+        {
+            sendUniform(&*i);
+            ++numUploads_;
+        }
+    }
+
+    // upload changed range of each block
+    for (auto b = blocks_.begin(); b != blocks_.end(); ++b)
+    if (b->dirtyEnd > b->dirtyBegin)
+    {
+        SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, b->buffer) );
+        SCH_CHECK_GL( glBufferSubData(GL_UNIFORM_BUFFER, b->dirtyBegin,
+                                      b->dirtyEnd - b->dirtyBegin, &b->data[b->dirtyBegin]) );
+        b->dirtyBegin = b->data.size();
+        b->dirtyEnd = 0;
+        ++numUploads_;
+    }
+    SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, 0) );
+}
+
+void Glsl::writeBlockUniform_(const Uniform& u)
+{
+    UniformBlock& b = blocks_[u.block_];
+
+    size_t size;
+    const void * src;
+    switch (u.type_)
+    {
+        case GL_FLOAT:      size = 1 * sizeof(GLfloat); src = u.floats; break;
+        case GL_FLOAT_VEC2: size = 2 * sizeof(GLfloat); src = u.floats; break;
+        case GL_FLOAT_VEC3: size = 3 * sizeof(GLfloat); src = u.floats; break;
+        case GL_FLOAT_VEC4: size = 4 * sizeof(GLfloat); src = u.floats; break;
+        case GL_INT:        size = sizeof(GLint); src = u.ints; break;
+        // other types are not editable and stay zero
+        default: return;
+    }
+
+    if (u.offset_ < 0 || u.offset_ + size > b.data.size())
+        return;
+
+    memcpy(&b.data[u.offset_], src, size);
+    b.dirtyBegin = std::min(b.dirtyBegin, (size_t)u.offset_);
+    b.dirtyEnd = std::max(b.dirtyEnd, u.offset_ + size);
+}
+
+void Glsl::getUniformBlocks_()
+{
+    releaseUniformBlocks_();
+    frameBlock_ = FrameBlock();
+    frameBlockIndex_ = -1;
+
+    GLint num = 0, maxLength = 0, maxBindings = 0;
+    SCH_CHECK_GL( glGetProgramiv(shader_, GL_ACTIVE_UNIFORM_BLOCKS, &num) );
+    SCH_CHECK_GL( glGetProgramiv(shader_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength) );
+    SCH_CHECK_GL( glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &maxBindings) );
+
+    const QByteArray& frameName = appSettings->shaderNames().frame;
+
+    GLuint binding = SCH_FRAME_BLOCK_BINDING + 1;
+    for (GLint i=0; i<num; ++i)
+    {
+        GLsizei length;
+        std::vector<GLchar> name(maxLength + 1);
+        SCH_CHECK_GL( glGetActiveUniformBlockName(shader_, i, name.size(), &length, &name[0]) );
+
+        GLint size;
+        SCH_CHECK_GL( glGetActiveUniformBlockiv(shader_, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size) );
+
+        // the per-frame block is provided by the renderer
+        if (frameName == &name[0])
+        {
+            SCH_CHECK_GL( glUniformBlockBinding(shader_, i, SCH_FRAME_BLOCK_BINDING) );
+            frameBlockIndex_ = i;
+            frameBlock_.size = size;
+            continue;
+        }
+
+        if ((GLint)binding >= maxBindings)
+        {
+            log_ += QString("too many uniform blocks, %1 is not bound\n").arg(&name[0]);
+            continue;
+        }
+
+        UniformBlock b;
+        b.name = QString(&name[0]);
+        b.index = i;
+        b.binding = binding++;
+        b.data.resize(size);
+        // upload once completely
+        b.dirtyBegin = 0;
+        b.dirtyEnd = size;
+
+        SCH_CHECK_GL( glGenBuffers(1, &b.buffer) );
+        SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, b.buffer) );
+        SCH_CHECK_GL( glBufferData(GL_UNIFORM_BUFFER, size, 0, GL_DYNAMIC_DRAW) );
+
+        SCH_CHECK_GL( glUniformBlockBinding(shader_, i, b.binding) );
+
+        blocks_.push_back(b);
+    }
+
+    SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, 0) );
+}
+
+void Glsl::sendSpecialUniforms(const Mat4& projection, const Mat4& view,
+                               float time, float aspect)
+{
+    if ((int)attribs_.projection >= 0)
+        SCH_CHECK_GL( glUniformMatrix4fv(attribs_.projection, 1, GL_FALSE,
+                                         glm::value_ptr(projection)) );
+    if ((int)attribs_.view >= 0)
+        SCH_CHECK_GL( glUniformMatrix4fv(attribs_.view, 1, GL_FALSE,
+                                         glm::value_ptr(view)) );
+    if ((int)attribs_.time >= 0)
+        SCH_CHECK_GL( glUniform1f(attribs_.time, time) );
+    if ((int)attribs_.aspect >= 0)
+        SCH_CHECK_GL( glUniform1f(attribs_.aspect, aspect) );
+
+    // --- per-frame block ---
+
+    const FrameBlock& fb = frameBlock_;
+    if (fb.size <= 0)
+        return;
+
+    frameBlockData_.resize(fb.size);
+    unsigned char * data = &frameBlockData_[0];
+
+    // offsets are reflected from the shader
+    if (fb.projection >= 0 && fb.projection + 64 <= fb.size)
+        memcpy(data + fb.projection, glm::value_ptr(projection), 64);
+    if (fb.view >= 0 && fb.view + 64 <= fb.size)
+        memcpy(data + fb.view, glm::value_ptr(view), 64);
+    if (fb.time >= 0 && fb.time + 4 <= fb.size)
+        memcpy(data + fb.time, &time, 4);
+    if (fb.aspect >= 0 && fb.aspect + 4 <= fb.size)
+        memcpy(data + fb.aspect, &aspect, 4);
+
+    if (!frameBlockBuffer_)
+        SCH_CHECK_GL( glGenBuffers(1, &frameBlockBuffer_) );
+
+    // one upload for all
+    SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, frameBlockBuffer_) );
+    SCH_CHECK_GL( glBufferData(GL_UNIFORM_BUFFER, fb.size, data, GL_STREAM_DRAW) );
+    SCH_CHECK_GL( glBindBuffer(GL_UNIFORM_BUFFER, 0) );
+    SCH_CHECK_GL( glBindBufferBase(GL_UNIFORM_BUFFER, SCH_FRAME_BLOCK_BINDING, frameBlockBuffer_) );
+}
+
+void Glsl::releaseUniformBlocks_()
+{
+    for (auto i = blocks_.begin(); i != blocks_.end(); ++i)
+        SCH_CHECK_GL( glDeleteBuffers(1, &i->buffer) );
+    blocks_.clear();
 }
 
 void Glsl::releaseGL()
 {
-    SCH_CHECK_GL( glDeleteProgram(shader_) );
+    cancelCompile();
+    // (finishes the discarded jobs)
+    delete compileThread_;
+    compileThread_ = 0;
+    clearStageCache_();
+    clearLinkedCache_();
+    releaseUniformBlocks_();
+    if (frameBlockBuffer_)
+    {
+        SCH_CHECK_GL( glDeleteBuffers(1, &frameBlockBuffer_) );
+        frameBlockBuffer_ = 0;
+    }
+    // (the program only exists after a successful compile)
+    if (ready_)
+        SCH_CHECK_GL( glDeleteProgram(shader_) );
     ready_ = activated_ = false;
 }
@@ -21,12 +21,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef GLSL_H
 #define GLSL_H
 
-#include <memory> // for std::shared_ptr
+#include <vector>
 
 #include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QMap>
 
 #include "opengl.h"
+#include "vector.h"
+#include "glslpreprocessor.h"
 
+class ShaderCompileThread;
 
 /** Container for a GLSL uniform. */
 struct Uniform
@@ -46,26 +52,44 @@ struct Uniform
     GLenum type() const { return type_; }
     /** Number of instances (for arrays) */
     GLint size() const { return size_; }
-    /** Uniform location, to send the stuff over */
+    /** Uniform location, to send the stuff over.
+        -1 for members of uniform blocks */
     GLint location() const { return location_; }
 
-    friend class Glsl;
-    friend void privateUniformDeleter(Uniform*);
+    /** Index of the uniform block in the Glsl or -1 for the default block */
+    int block() const { return block_; }
 
-    // ----------- private area -----------
-private:
+    /** Byte offset of the uniform inside it's block */
+    GLint offset() const { return offset_; }
+
+    /** Returns true if the uniform is compiled into the program as a constant.
+        Changing the value needs a re-freeze, see Glsl::freezeUniforms(). */
+    bool frozen() const { return frozen_; }
+
+    /** Returns true if the values need to be send to the GPU */
+    bool changed() const { return changed_; }
+
+    /** Marks the uniform to be send on the next Glsl::sendUniforms().
+        Call this after changing floats or ints. */
+    void setChanged() { changed_ = true; }
 
     /** Constructor (initializes all to zero) */
     Uniform();
-    /** Private destructor to avoid stupid things. */
-    ~Uniform() { }
 
-    void copyValuesFrom_(Uniform*);
+    friend class Glsl;
+
+    // ----------- private area -----------
+private:
+
+    void copyValuesFrom_(const Uniform&);
 
     QString name_;
     GLenum type_;
     GLint size_;
     GLint location_;
+    int block_;
+    GLint offset_;
+    bool changed_, frozen_;
 
 };
 
@@ -77,9 +101,25 @@ class Glsl
 {
 public:
 
+    /** Layout of the per-frame uniform block with the special uniforms,
+        as reflected from the shader. The block is bound to
+        SCH_FRAME_BLOCK_BINDING and filled by sendSpecialUniforms().
+        Offsets are -1 for unused members, size is 0 if there is no such block. */
+    struct FrameBlock
+    {
+        GLint size,
+            projection,
+            view,
+            time,
+            aspect;
+
+        FrameBlock() : size(0), projection(-1), view(-1), time(-1), aspect(-1) { }
+    };
+
     // ---------------- ctor -----------------
 
     Glsl();
+    ~Glsl();
 
     // ----------- query ---------------------
 
@@ -89,9 +129,33 @@ public:
     /** Has the source changed and shader needs recompilation? */
     bool sourceChanged() const { return sourceChanged_; }
 
-    /** Is the shader ready to use? */
+    /** Is the shader ready to use?
+        This stays true for the previous program while a new one
+        is compiling or when the new one failed to compile. */
     bool ready() const { return ready_; }
 
+    /** Is a compilation started by beginCompile() still running? */
+    bool isCompiling() const { return compiling_; }
+
+    /** Did the last finished compilation succeed? */
+    bool compileSucceeded() const { return succeeded_; }
+
+    /** Was the last program taken from the cache of linked variants? */
+    bool reusedVariant() const { return pendingReused_; }
+
+    /** Was the last program loaded from the ProgramCache? */
+    bool loadedFromCache() const { return pendingFromCache_; }
+
+    /** Time of compiling both stages in the last compilation.
+        Only accurate for compile() and the compile thread,
+        with driver-side parallel compile, beginCompile() does not wait for the driver. */
+    double compileTime() const { return compileMs_; }
+
+    /** Time of linking in the last compilation.
+        Only accurate for compile() and the compile thread,
+        with driver-side parallel compile, beginCompile() does not wait for the driver. */
+    double linkTime() const { return linkMs_; }
+
     /** Returns if the shader has been activated.
         @note If, after activation, activate() or deactivate() is called on a
         different shader, this value will not reflect the GPU state! */
@@ -105,7 +169,16 @@ public:
         The public members of the Uniform struct can be manipulated.
         Can be called after succesful compilation.
         @p index must be < numUniforms() */
-    Uniform * getUniform(size_t index) { return uniforms_[index].get(); }
+    Uniform * getUniform(size_t index) { return &uniforms_[index]; }
+
+    /** Returns the number of glUniform and glBufferSubData calls of the last sendUniforms() */
+    int numUniformUploads() const { return numUploads_; }
+
+    /** Returns the number of user uniform blocks */
+    size_t numUniformBlocks() const { return blocks_.size(); }
+
+    /** Returns the layout of the per-frame block */
+    const FrameBlock& getFrameBlock() const { return frameBlock_; }
 
     /** Returns the vertex attribute locations used to send vertex
         data to the shader.
@@ -115,21 +188,88 @@ public:
 
     // ---------- source/compiler ------------
 
-    /** Sets the source for the vertex shader. Previous content will be overwritten. */
-    void setVertexSource(const QString& text);
-
-    /** Sets the source for the fragment shader. Previous content will be overwritten. */
-    void setFragmentSource(const QString& text);
-
-    /** Tries to compile the shader.
-        Any previous program will be destroyed but the values of uniforms are kept.
+    /** Sets the source for the vertex shader. Previous content will be overwritten.
+        @p filename is used to resolve relative #include directives. */
+    void setVertexSource(const QString& text, const QString& filename = QString());
+
+    /** Sets the source for the fragment shader. Previous content will be overwritten.
+        @p filename is used to resolve relative #include directives. */
+    void setFragmentSource(const QString& text, const QString& filename = QString());
+
+    /** Returns all files (absolute paths) included by the sources at the last compile */
+    const QSet<QString>& dependencies() const { return dependencies_; }
+
+    /** Returns true if the last compiled sources included the file */
+    bool dependsOn(const QString& filename) const;
+
+    /** Tells that a file changed on disk, which might be included.
+        The next compile reads it again. */
+    void fileChanged(const QString& filename);
+
+    /** Sets the preprocessor definitions that select the shader variant.
+        Each entry is either "NAME" or "NAME=VALUE" and is injected
+        as #define after the #version line of both sources.
+        Programs of previously compiled variants are kept linked,
+        so switching back does not compile again. */
+    void setDefines(const QStringList& defines);
+
+    /** Returns the definitions of the current variant */
+    const QStringList& defines() const { return defines_; }
+
+    /** Returns the symbols that the sources test with #ifdef, #ifndef
+        or defined(), excluding those that the sources #define themselves.
+        Available after compilation. */
+    const QStringList& switches() const { return switches_; }
+
+    /** Returns the symbols that take a value, e.g. from #if STEPS > 64,
+        or from a default like #ifndef STEPS / #define STEPS 64.
+        The map value is that default or empty. They are set through
+        setDefines() with NAME=VALUE. Available after compilation. */
+    const QMap<QString, QString>& valueDefines() const { return valueDefines_; }
+
+    /** Takes the current values of the user uniforms and replaces their
+        declarations with const definitions on the next compile.
+        Calling it again while frozen takes the values again.
+        Only single declarations of float, vec2-4 and int in the default
+        block are frozen. The frozen uniforms stay in the uniform list,
+        so their values can still be edited. */
+    void freezeUniforms();
+
+    /** Returns to the dynamic uniforms on the next compile */
+    void unfreezeUniforms();
+
+    /** Are the uniforms baked into the program? */
+    bool uniformsFrozen() const { return !frozen_.isEmpty(); }
+
+    /** Tries to compile the shader and waits for the result.
+        On success, any previous program will be destroyed but the values of uniforms are kept.
+        On failure, the previous program stays in use.
         @returns true on success, also sets ready() to true. */
     bool compile();
 
+    /** Starts compiling the shader without waiting for the driver.
+        A compilation that is still running is cancelled.
+        The previous program stays in use until pollCompile() reports the
+        new one to be finished.
+        @returns false if the compilation failed right away. */
+    bool beginCompile();
+
+    /** Checks if the compilation started by beginCompile() is finished.
+        Without KHR_parallel_shader_compile, the shaders are compiled
+        by a ShaderCompileThread. Only if that is not available
+        either, this waits for the driver.
+        When finished, the result is available through compileSucceeded()
+        and the new program replaces the previous one on success.
+        @returns true when finished, or when nothing is compiling. */
+    bool pollCompile();
+
+    /** Discards a running compilation */
+    void cancelCompile();
+
     // ------------ usage --------------------
 
-    /** Activates the shader. Subsequent OpenGL calls will
-        be affected by the shader's workings. */
+    /** Activates the shader and binds the uniform buffers.
+        Subsequent OpenGL calls will be affected by the shader's workings. */
     void activate();
 
     /** Turns the shader off. */
@@ -140,36 +280,239 @@ public:
         @note The shader must be activated. */
     void sendUniform(const Uniform * uniform);
 
-    /** Sends all uniform values to the GPU.
+    /** Sends all changed uniform values to the GPU.
+        After compilation, all uniforms are send once.
+        Members of uniform blocks are collected and uploaded
+        with one glBufferSubData() per block.
         @note The shader must be activated. */
     void sendUniforms();
 
+    /** Sends the application specific uniforms (see AppSettings::ShaderNames),
+        either as plain uniforms or through the per-frame uniform block.
+        Used by the RenderWidget and the headless renderer.
+        @note The shader must be activated. */
+    void sendSpecialUniforms(const Mat4& projection, const Mat4& view,
+                             float time, float aspect);
+
     /** Releases GPU resources. */
     void releaseGL();
 
 private:
 
+    /** Implementation of beginCompile(), @p wait = true times the stages */
+    bool beginCompile_(bool wait);
+
+    /** Expands the #include directives of both sources
+        and injects the defines. Returns false on errors. */
+    bool preprocess_();
+
+    /** Adds the #define lines of the variant after the #version line */
+    void applyDefines_(QString& source) const;
+
+    /** Replaces the declarations of the frozen uniforms with constants
+        and adds their names to frozenApplied_ */
+    void applyFrozen_(QString& source);
+
+    /** Returns the GLSL constructor for the value of a frozen uniform */
+    static QString frozenValue_(const Uniform&);
+
+    /** Adds the variant switches found in @p source to switches_ */
+    void findSwitches_(const QString& source);
+
+    /** Returns the key of the linked program cache */
+    QByteArray makeProgramKey_() const;
+
+    /** Puts a linked program into the cache and evicts the least recently used */
+    void storeLinked_(const QByteArray& key, GLuint program);
+
+    /** Deletes all cached linked programs */
+    void clearLinkedCache_();
+
+    /** Checks the results of the pending program and
+        exchanges it with the current one on success. */
+    bool finishCompile_();
+
+    /** Binds the standardized attribute names to the fixed
+        SCH_ATTRIB_* locations. Needs to be called before linking. */
+    void bindAttribLocations_(GLuint program);
+
+    /** Returns true if the extension is supported */
+    bool hasExtension_(const char * name);
+
+    /** Returns true if the driver compiles in the background */
+    bool hasParallelCompile_();
+
+    /** Returns the thread for compiling without KHR_parallel_shader_compile,
+        created on first use with a context shared with the current one.
+        Returns NULL if that is not possible. */
+    ShaderCompileThread * getCompileThread_();
+
+    /** Returns a string of all attribute names and their bound locations */
+    QString attributeBindings_() const;
+
+    /** Returns true if program binaries are supported by the driver */
+    bool hasProgramBinary_();
+
+    /** Tries to load the program from the ProgramCache.
+        On failure, shader_ is a fresh program object again. */
+    bool loadProgramBinary_(const QByteArray& key);
+
+    /** Stores the linked program in the ProgramCache */
+    void storeProgramBinary_(const QByteArray& key);
+
     /** Gets the standardized attributes and uniforms. */
     void getSpecialLocations_();
 
     /** Gets all used uniforms and populates the uniforms_ list */
     void getUniforms_();
 
-    /** Compiles one of the vertex/fragment shaders and attaches to current programObject */
-    bool compileShader_(GLenum type, const QString& typeName, const QString& source);
+    /** Gets the active uniform blocks, creates their buffers
+        and assigns the binding points. */
+    void getUniformBlocks_();
+
+    /** Deletes the buffers of the uniform blocks */
+    void releaseUniformBlocks_();
+
+    /** Copies the value of a block member to the block's buffer data */
+    void writeBlockUniform_(const Uniform&);
+
+    /** One shader stage of the pending program */
+    struct Stage
+    {
+        GLuint shader;
+        /** the shader object belongs to stageCache_ */
+        bool cached;
+        QByteArray key;
+        /** time of the compile-status wait, 0 if unknown */
+        double ms;
+    };
+
+    /** A compiled shader object for reuse */
+    struct CachedStage
+    {
+        GLuint shader;
+        /** time it took to compile, 0 if unknown */
+        double ms;
+        quint64 lastUse;
+    };
+
+    /** Creates one of the vertex/fragment shaders and attaches it
+        to the pending programObject. With @p compile, compiling is started,
+        otherwise it's left to the caller or the compile thread. Unchanged sources are
+        taken from the shader object cache. Returns the shader object or 0 */
+    GLuint compileShader_(GLenum type, const QString& typeName, const QString& source,
+                          Stage& stage, bool compile);
+
+    /** Checks the compile status of the shader object and adds the compiler log.
+        Successfully compiled shaders are put into the cache. */
+    bool checkShader_(Stage& stage, const QString& typeName);
+
+    /** Returns the key of the shader object cache */
+    static QByteArray stageKey_(GLenum type, const QString& source);
+
+    /** Puts a shader object into the cache and evicts the least recently used */
+    void storeStage_(const QByteArray& key, GLuint shader, double ms);
+
+    /** Deletes all cached shader objects */
+    void clearStageCache_();
+
+    /** A linked program of a variant for reuse */
+    struct LinkedProgram
+    {
+        GLuint program;
+        quint64 lastUse;
+    };
 
     QString vertSource_,
             fragSource_,
+            vertFile_,
+            fragFile_,
+            vertExpanded_,
+            fragExpanded_,
             log_;
 
+    GlslPreprocessor preprocessor_;
+    QSet<QString> dependencies_;
+
+    QStringList defines_, switches_;
+    QMap<QString, QString> valueDefines_;
+
+    /** glsl type and value of frozen uniforms by name */
+    struct FrozenUniform
+    {
+        QString type, value;
+        Uniform uniform;
+    };
+    QHash<QString, FrozenUniform> frozen_;
+    /** names of the frozen uniforms found in the last preprocessed sources */
+    QSet<QString> frozenApplied_;
+
     GLenum shader_;
 
-    bool sourceChanged_, ready_, activated_;
+    /** program and shader objects of the running compilation */
+    GLuint pendingProgram_;
+    Stage pendingStage_[2];
+    QByteArray pendingCacheKey_, pendingProgramKey_;
+    /** key of the current program in the linked program cache */
+    QByteArray programKey_;
+
+    bool sourceChanged_, ready_, activated_,
+         compiling_, succeeded_, pendingFromCache_, pendingReused_;
+
+    /** -1 = unknown */
+    int parallelCompile_;
 
-    std::vector<std::shared_ptr<Uniform>>
+    /** fallback for parallel compile, and the ticket of the pending program
+        on the thread or 0 */
+    ShaderCompileThread * compileThread_;
+    bool compileThreadFailed_;
+    int compileTicket_;
+
+    // --- shader object cache ---
+
+    static const int maxCachedStages_ = 32;
+    QHash<QByteArray, CachedStage> stageCache_;
+    quint64 stageUseCount_;
+    int stagesCompiled_, stagesReused_;
+    double stageMsSaved_;
+
+    // --- linked program cache (variants) ---
+
+    static const int maxLinkedPrograms_ = 16;
+    QHash<QByteArray, LinkedProgram> linkedCache_;
+    int programsReused_;
+
+    /** timing of the last compilation in milliseconds */
+    double compileMs_, linkMs_;
+
+    /** uniforms of the current and the previous program.
+        The previous ones stay valid until the next successful compilation. */
+    std::vector<Uniform>
         uniforms_,
         oldUniforms_;
 
+    int numUploads_;
+
+    // --- uniform blocks ---
+
+    struct UniformBlock
+    {
+        QString name;
+        GLuint index, binding, buffer;
+        /** cpu copy of the buffer */
+        std::vector<unsigned char> data;
+        /** byte range that needs upload */
+        size_t dirtyBegin, dirtyEnd;
+    };
+
+    std::vector<UniformBlock> blocks_;
+    FrameBlock frameBlock_;
+    /** block index of the frame block in the current program or -1 */
+    GLint frameBlockIndex_;
+    /** buffer for the frame block and it's cpu copy */
+    GLuint frameBlockBuffer_;
+    std::vector<unsigned char> frameBlockData_;
+
     // --- attributes ---
 
     ShaderLocations attribs_;
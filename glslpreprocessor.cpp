@@ -0,0 +1,292 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QRegularExpression>
+#include <QCryptographicHash>
+
+#include "glslpreprocessor.h"
+
+namespace {
+
+    /** matches #include "file" and #include <file> */
+    const QRegularExpression includeExp(
+            "^\\s*#\\s*include\\s*([\"<])([^\">]+)[\">]");
+
+    /** maximum number of cached expansions */
+    const int maxExpanded = 256;
+
+    QString absolute(const QString& filename)
+    {
+        return filename.isEmpty()
+                ? filename
+                : QDir::cleanPath(QFileInfo(filename).absoluteFilePath());
+    }
+
+} // namespace
+
+
+GlslPreprocessor::GlslPreprocessor()
+{
+    // number 0 is the main source
+    sourceFiles_ << QString();
+}
+
+void GlslPreprocessor::setIncludePaths(const QStringList &paths)
+{
+    includePaths_ = paths;
+    clear();
+}
+
+void GlslPreprocessor::clear()
+{
+    files_.clear();
+    expanded_.clear();
+}
+
+void GlslPreprocessor::fileChanged(const QString &filename)
+{
+    // the closure keys take care of the expansion cache
+    files_.remove(absolute(filename));
+}
+
+QString GlslPreprocessor::sourceNumberLegend() const
+{
+    QString legend;
+    for (int i=1; i<sourceFiles_.size(); ++i)
+        if (deps_.contains(sourceFiles_[i]))
+            legend += QString("%1: %2\n").arg(i).arg(sourceFiles_[i]);
+    return legend;
+}
+
+QString GlslPreprocessor::resolve_(const QString &spec, bool quoted,
+                                   const QString &includingFile) const
+{
+    // relative to including file
+    if (quoted && !includingFile.isEmpty())
+    {
+        QFileInfo info(QFileInfo(includingFile).absoluteDir(), spec);
+        if (info.isFile())
+            return absolute(info.filePath());
+    }
+
+    for (auto &path : includePaths_)
+    {
+        QFileInfo info(QDir(path), spec);
+        if (info.isFile())
+            return absolute(info.filePath());
+    }
+
+    return QString();
+}
+
+int GlslPreprocessor::sourceNumber_(const QString &filename)
+{
+    auto i = sourceNumbers_.find(filename);
+    if (i != sourceNumbers_.end())
+        return i.value();
+
+    const int num = sourceFiles_.size();
+    sourceFiles_ << filename;
+    sourceNumbers_.insert(filename, num);
+    return num;
+}
+
+const GlslPreprocessor::File * GlslPreprocessor::file_(const QString &filename)
+{
+    QFileInfo info(filename);
+    if (!info.isFile())
+    {
+        files_.remove(filename);
+        return 0;
+    }
+
+    // up-to-date?
+    auto i = files_.find(filename);
+    if (i != files_.end()
+        && i.value().modified == info.lastModified()
+        && i.value().size == info.size())
+        return &i.value();
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    const QByteArray data = file.readAll();
+
+    File f;
+    f.text = QString::fromUtf8(data);
+    f.hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    f.modified = info.lastModified();
+    f.size = info.size();
+
+    // collect the include edges
+    const QStringList lines = f.text.split('\n');
+    for (auto &line : lines)
+    {
+        auto m = includeExp.match(line);
+        if (!m.hasMatch())
+            continue;
+        const QString inc = resolve_(m.captured(2), m.captured(1) == "\"", filename);
+        if (!inc.isEmpty())
+            f.includes << inc;
+    }
+
+    return &files_.insert(filename, f).value();
+}
+
+QByteArray GlslPreprocessor::closureKey_(const QString &filename, QStringList &stack)
+{
+    auto k = keys_.find(filename);
+    if (k != keys_.end())
+        return k.value();
+
+    const File * f = file_(filename);
+    if (!f)
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(f->hash);
+
+    // (copy, the hash might change while recursing)
+    const QStringList includes = f->includes;
+    for (auto &inc : includes)
+    {
+        // recursion, reported by expand_()
+        if (stack.contains(inc))
+            return QByteArray();
+
+        stack << inc;
+        const QByteArray sub = closureKey_(inc, stack);
+        stack.removeLast();
+
+        if (sub.isEmpty())
+            return QByteArray();
+
+        deps_.insert(inc);
+        hash.addData(sub);
+    }
+
+    const QByteArray key = hash.result();
+    keys_.insert(filename, key);
+    return key;
+}
+
+QString GlslPreprocessor::process(const QString &source, const QString &filename)
+{
+    log_.clear();
+    deps_.clear();
+    keys_.clear();
+    mainFile_ = absolute(filename);
+
+    if (expanded_.size() > maxExpanded)
+        expanded_.clear();
+
+    QStringList stack;
+    if (!mainFile_.isEmpty())
+        stack << mainFile_;
+
+    QString out;
+    if (!expand_(source, mainFile_, 0, stack, out))
+        return QString();
+
+    return out;
+}
+
+bool GlslPreprocessor::expandFile_(const QString &filename, QStringList &stack, QString &out)
+{
+    const QByteArray key = closureKey_(filename, stack);
+
+    auto e = expanded_.find(key);
+    if (!key.isEmpty() && e != expanded_.end())
+    {
+        out += e.value();
+        return true;
+    }
+
+    const File * f = file_(filename);
+    if (!f)
+    {
+        log_ += QString("could not read %1\n").arg(filename);
+        return false;
+    }
+
+    // (copy, the hash might change while recursing)
+    const QString text = f->text;
+    QString expanded;
+    if (!expand_(text, filename, sourceNumber_(filename), stack, expanded))
+        return false;
+
+    if (!key.isEmpty())
+        expanded_.insert(key, expanded);
+    out += expanded;
+    return true;
+}
+
+bool GlslPreprocessor::expand_(const QString &text, const QString &filename,
+                               int sourceNumber, QStringList &stack, QString &out)
+{
+    const QString name = filename.isEmpty() ? QString("source") : filename;
+
+    const QStringList lines = text.split('\n');
+    for (int i=0; i<lines.size(); ++i)
+    {
+        auto m = includeExp.match(lines[i]);
+        if (!m.hasMatch())
+        {
+            out += lines[i];
+            if (i + 1 < lines.size())
+                out += '\n';
+            continue;
+        }
+
+        const QString spec = m.captured(2);
+        const QString inc = resolve_(spec, m.captured(1) == "\"", filename);
+        if (inc.isEmpty())
+        {
+            log_ += QString("%1:%2: include file '%3' not found\n")
+                    .arg(name).arg(i+1).arg(spec);
+            return false;
+        }
+        if (stack.contains(inc))
+        {
+            log_ += QString("%1:%2: recursive include of '%3'\n")
+                    .arg(name).arg(i+1).arg(spec);
+            return false;
+        }
+
+        deps_.insert(inc);
+
+        // replace the include line with the file's content
+        // and tell the compiler where the lines come from
+        out += QString("#line 1 %1\n").arg(sourceNumber_(inc));
+
+        stack << inc;
+        if (!expandFile_(inc, stack, out))
+            return false;
+        stack.removeLast();
+
+        out += QString("\n#line %1 %2\n").arg(i + 2).arg(sourceNumber);
+    }
+
+    return true;
+}
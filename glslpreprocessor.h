@@ -0,0 +1,137 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef GLSLPREPROCESSOR_H
+#define GLSLPREPROCESSOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QDateTime>
+
+/** Expands @code #include "file" @endcode and @code #include <file> @endcode
+    directives in GLSL sources.
+
+    <p>"file" is searched relative to the including file first, then in the
+    includePaths(). <file> is only searched in the includePaths().</p>
+
+    <p>Each file gets a unique source string number and the expanded text
+    contains @code #line @endcode directives, so compiler messages refer to
+    the line in the original file. sourceNumberLegend() lists the numbers.
+    The main source always has number 0.</p>
+
+    <p>File contents are cached and only read again when the modification
+    time or size changed (or fileChanged() was called). Expanded files are
+    cached by the hash of their include closure, so editing a shared header
+    only re-expands the files that include it.</p>
+
+    <p>Use header guards (#ifndef) in files that are included more than once,
+    #pragma once is not supported. Recursive includes are reported as error.</p>
+*/
+class GlslPreprocessor
+{
+public:
+    GlslPreprocessor();
+
+    // ----------- query ---------------------
+
+    /** Messages of the last process() call */
+    const QString& log() const { return log_; }
+
+    /** Directories to search for included files */
+    const QStringList& includePaths() const { return includePaths_; }
+
+    /** Returns all files (absolute paths) that the source of
+        the last process() call included, directly or indirectly. */
+    const QSet<QString>& dependencies() const { return deps_; }
+
+    /** Returns a readable list of the source string numbers of the
+        last process() call, for annotating compiler logs */
+    QString sourceNumberLegend() const;
+
+    // ----------- setter --------------------
+
+    /** Sets the directories to search for included files.
+        This clears the caches. */
+    void setIncludePaths(const QStringList& paths);
+
+    /** Tells the preprocessor that the file has changed, e.g. when
+        it was saved from the editor. */
+    void fileChanged(const QString& filename);
+
+    /** Forgets all cached files */
+    void clear();
+
+    // ----------- processing ----------------
+
+    /** Returns the expanded @p source.
+        @p filename is the file that the source belongs to (may be empty)
+        and is used to resolve relative includes.
+        Returns an empty string on errors, see log(). */
+    QString process(const QString& source, const QString& filename = QString());
+
+private:
+
+    struct File
+    {
+        QString text;
+        QByteArray hash;
+        QDateTime modified;
+        qint64 size;
+        /** resolved include files, in order of appearance */
+        QStringList includes;
+    };
+
+    /** Returns the cached file, reads it if needed, or returns NULL */
+    const File * file_(const QString& filename);
+
+    /** Returns the absolute path of an include spec or an empty string */
+    QString resolve_(const QString& spec, bool quoted, const QString& includingFile) const;
+
+    /** Returns the source string number for a file */
+    int sourceNumber_(const QString& filename);
+
+    /** Hash over the file and all of it's includes */
+    QByteArray closureKey_(const QString& filename, QStringList& stack);
+
+    /** Expands the text of a file, or the main source if @p filename is empty */
+    bool expand_(const QString& text, const QString& filename, int sourceNumber,
+                 QStringList& stack, QString& out);
+
+    /** Expands an included file, using the expansion cache */
+    bool expandFile_(const QString& filename, QStringList& stack, QString& out);
+
+    QStringList includePaths_;
+
+    QHash<QString, File> files_;
+    /** expanded text by closure key */
+    QHash<QByteArray, QString> expanded_;
+    /** closure keys of the current process() call */
+    QHash<QString, QByteArray> keys_;
+
+    QHash<QString, int> sourceNumbers_;
+    QStringList sourceFiles_;
+
+    QString log_, mainFile_;
+    QSet<QString> deps_;
+};
+
+#endif // GLSLPREPROCESSOR_H
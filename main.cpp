@@ -18,21 +18,108 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <cstring>
+
 #include <QApplication>
+#include <QGuiApplication>
+#include <QFileInfo>
 
 #include "mainwindow.h"
 #include "appsettings.h"
+#include "programcache.h"
+#include "batchcompiler.h"
+#include "offscreenrenderer.h"
+
+namespace {
+
+    /** Creates the single instances that gui and batch mode share */
+    void createGlobals(QObject * parent)
+    {
+        // create a single instance for application settings
+        appSettings = new AppSettings(parent);
+
+        // linked shader programs are kept next to the settings file
+        if (appSettings->getValue("ProgramCache/enabled").toBool())
+            programCache = new ProgramCache(
+                    QFileInfo(appSettings->fileName()).absolutePath() + "/programcache",
+                    (qint64)appSettings->getValue("ProgramCache/maxSizeMB").toInt() * 1024 * 1024);
+    }
+
+    void deleteGlobals()
+    {
+        delete programCache;
+        programCache = 0;
+    }
+
+    /** Picks a platform plugin for the command line modes,
+        unless QT_QPA_PLATFORM is set. */
+    void setHeadlessPlatform()
+    {
+        if (!qgetenv("QT_QPA_PLATFORM").isEmpty())
+            return;
+
+        // the offscreen plugin creates its contexts through GLX,
+        // which is fine as long as there is an X server
+        if (!qgetenv("DISPLAY").isEmpty())
+        {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+            return;
+        }
+
+        // Without any display, eglfs on Mesa's surfaceless EGL platform
+        // still gives pbuffer surfaces and framebuffer objects.
+        // No device integration and no input handling is needed.
+        qputenv("QT_QPA_PLATFORM", "eglfs");
+        if (qgetenv("EGL_PLATFORM").isEmpty())
+            qputenv("EGL_PLATFORM", "surfaceless");
+        if (qgetenv("QT_QPA_EGLFS_INTEGRATION").isEmpty())
+            qputenv("QT_QPA_EGLFS_INTEGRATION", "none");
+        qputenv("QT_QPA_EGLFS_DISABLE_INPUT", "1");
+    }
+
+    bool hasArgument(int argc, char *argv[], const char * arg)
+    {
+        for (int i=1; i<argc; ++i)
+            if (!strcmp(argv[i], arg))
+                return true;
+        return false;
+    }
+
+} // namespace
 
 int main(int argc, char *argv[])
 {
+    // --- command line mode without windows ---
+
+    const bool batch = hasArgument(argc, argv, "--compile-batch"),
+               render = hasArgument(argc, argv, "--render");
+    if (batch || render)
+    {
+        setHeadlessPlatform();
+
+        QGuiApplication a(argc, argv);
+        createGlobals(&a);
+
+        const int ret = batch ? BatchCompiler::exec(a.arguments())
+                              : OffscreenRenderer::exec(a.arguments());
+
+        deleteGlobals();
+        return ret;
+    }
+
+    // --- gui mode ---
+
     QApplication a(argc, argv);
 
-    // create a single instance for application settings
-    appSettings = new AppSettings(&a);
+    createGlobals(&a);
 
     MainWindow w;
 
     w.show();
 
-    return a.exec();
+    const int ret = a.exec();
+
+    deleteGlobals();
+
+    return ret;
 }
@@ -27,6 +27,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include <QLayout>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QCheckBox>
+#include <QLineEdit>
+#include <QTimer>
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
@@ -35,6 +40,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include "appsettings.h"
 #include "modelfactory.h"
 #include "model.h"
+#include "modelbenchmark.h"
+#include "modelbuilder.h"
 #include "glsl.h"
 #include "uniformwidgetfactory.h"
 
@@ -48,6 +55,25 @@ MainWindow::MainWindow(QWidget *parent) :
     // uniform factory/controller
     uniFactory_ = new UniformWidgetFactory(this);
 
+    // recompile on changes of included files
+    includeWatcher_ = new QFileSystemWatcher(this);
+    connect(includeWatcher_, SIGNAL(fileChanged(QString)), this, SLOT(slotIncludeChanged(QString)));
+
+    // re-freeze when the edits of frozen uniforms settle
+    refreezeTimer_ = new QTimer(this);
+    refreezeTimer_->setSingleShot(true);
+    refreezeTimer_->setInterval(500);
+    connect(refreezeTimer_, &QTimer::timeout, [=]()
+    {
+        if (doFreezeUniforms_->isChecked())
+            slotFreezeUniforms(true);
+    });
+
+    // model creation in background
+    modelBuilder_ = new ModelBuilder(this);
+    connect(modelBuilder_, SIGNAL(progress(int)), this, SLOT(slotModelProgress(int)));
+    connect(modelBuilder_, SIGNAL(finished(Model*,QString)), this, SLOT(slotModelFinished(Model*,QString)));
+
     createWidgets_();
     createMainMenu_();
 
@@ -88,9 +114,13 @@ void MainWindow::createWidgets_()
     QGLFormat glformat;
     glformat.setVersion(3,3);
     glformat.setDepth(true);
+    // (the context can not change it later without losing all resources)
+    glformat.setSwapInterval(appSettings->getValue("RenderSettings/vsync").toBool() ? 1 : 0);
     renderer_ = new RenderWidget(this, glformat);
     renderer_->setShader(shader_);
     connect(renderer_, SIGNAL(shaderCompiled()), this, SLOT(slotShaderCompiled()));
+    connect(renderer_, SIGNAL(benchmarkFinished(QString)), this, SLOT(slotBenchmarkFinished(QString)));
+    connect(renderer_, SIGNAL(statusMessage(QString)), this, SLOT(slotStatusMessage(QString)));
     auto dw = getDockWidget_("opengl_window", tr("OpenGL window"));
     rendererDock_ = dw;
     dw->setWidget(renderer_);
@@ -131,6 +161,20 @@ void MainWindow::createWidgets_()
     dw = getDockWidget_("uni_edit", tr("shader uniforms"));
     dw->setWidget(uniEdit_);
     addDockWidget(Qt::BottomDockWidgetArea, dw);
+
+    // pipeline statistics next to the uniforms
+    auto label = new QLabel(this);
+    QFont font("Monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    label->setFont(font);
+    label->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    connect(renderer_, SIGNAL(pipelineStatistics(QString)), label, SLOT(setText(QString)));
+    dw = getDockWidget_("pipeline_stats", tr("pipeline statistics"));
+    dw->setWidget(label);
+    addDockWidget(Qt::BottomDockWidgetArea, dw);
+    // only count while visible
+    connect(dw, SIGNAL(visibilityChanged(bool)), renderer_, SLOT(setPipelineStatistics(bool)));
 }
 
 void MainWindow::createMainMenu_()
@@ -199,12 +243,59 @@ void MainWindow::createMainMenu_()
     a->setCheckable(true);
     m->addAction(a);
     group->addAction(a);
+    modelGrid_ = a = new QAction(tr("Create &Grid"), this);
+    a->setCheckable(true);
+    m->addAction(a);
+    group->addAction(a);
 
     m->addSeparator();
     doGroupVertices_ = a = new QAction(tr("group vertices"), this);
     a->setCheckable(true);
     m->addAction(a);
     connect(a, SIGNAL(triggered()), this, SLOT(slotCreateModel()));
+    doWeldVertices_ = a = new QAction(tr("weld vertices"), this);
+    a->setCheckable(true);
+    m->addAction(a);
+    connect(a, SIGNAL(triggered()), this, SLOT(slotCreateModel()));
+    doInterleave_ = a = new QAction(tr("interleaved vertex layout"), this);
+    a->setCheckable(true);
+    m->addAction(a);
+    connect(a, SIGNAL(triggered()), this, SLOT(slotCreateModel()));
+
+    doCompactFormat_ = a = new QAction(tr("compact vertex format"), this);
+    a->setCheckable(true);
+    m->addAction(a);
+    connect(a, SIGNAL(triggered()), this, SLOT(slotCreateModel()));
+    doOptimizeIndices_ = a = new QAction(tr("optimize for vertex cache"), this);
+    a->setCheckable(true);
+    m->addAction(a);
+    connect(a, SIGNAL(triggered()), this, SLOT(slotCreateModel()));
+
+    m->addSeparator();
+    a = new QAction(tr("Benchmark vertex layouts"), this);
+    m->addAction(a);
+    connect(a, &QAction::triggered, [=]()
+    {
+        renderer_->requestBenchmark(ModelBenchmark::T_LAYOUTS);
+    });
+    a = new QAction(tr("Benchmark vertex formats"), this);
+    m->addAction(a);
+    connect(a, &QAction::triggered, [=]()
+    {
+        renderer_->requestBenchmark(ModelBenchmark::T_FORMATS);
+    });
+    a = new QAction(tr("Benchmark ungrouping"), this);
+    m->addAction(a);
+    connect(a, &QAction::triggered, [=]()
+    {
+        renderer_->requestBenchmark(ModelBenchmark::T_UNGROUP);
+    });
+    a = new QAction(tr("Benchmark grid creation"), this);
+    m->addAction(a);
+    connect(a, &QAction::triggered, [=]()
+    {
+        renderer_->requestBenchmark(ModelBenchmark::T_GRID);
+    });
 
 
     // --- shader menu ---
@@ -227,6 +318,20 @@ void MainWindow::createMainMenu_()
         appSettings->setValue("auto_compile", check);
     });
 
+    m->addSeparator();
+    a = new QAction(tr("&Freeze uniforms"), this);
+    a->setStatusTip(tr("Compiles the current uniform values as constants into the shader"));
+    doFreezeUniforms_ = a;
+    a->setCheckable(true);
+    m->addAction(a);
+    connect(a, SIGNAL(triggered(bool)), this, SLOT(slotFreezeUniforms(bool)));
+    a = new QAction(tr("Benchmark frozen uniforms"), this);
+    m->addAction(a);
+    connect(a, &QAction::triggered, [=]()
+    {
+        renderer_->requestBenchmark(ModelBenchmark::T_FROZEN);
+    });
+
     m->addSeparator();
     a = new QAction(tr("Go to &vertex editor"), this);
     a->setShortcut(Qt::ALT + Qt::Key_1);
@@ -256,6 +361,7 @@ void MainWindow::createMainMenu_()
     m->addAction(createRenderOptionAction_("doDepthTest", "depth test"));
     m->addAction(createRenderOptionAction_("doCullFace", "cull faces"));
     m->addAction(createRenderOptionAction_("doFrontFaceCCW", "front is counter-clockwise"));
+    m->addAction(createRenderOptionAction_("doShowHud", "frame-time overlay"));
     /* XXX: NOT WORKING YET
     m->addSeparator();
     a = new QAction(tr("external opengl view"), this);
@@ -283,6 +389,39 @@ void MainWindow::createMainMenu_()
     a->setShortcut(Qt::Key_F8);
     connect(a, SIGNAL(triggered()), renderer_, SLOT(stopAnimation()));
 
+    m->addSeparator();
+    // one target rate at a time
+    group = new QActionGroup(this);
+    const double rates[] = { 30., 60., 120., 144., 0. };
+    const double rate = appSettings->getValue("RenderSettings/targetFps").toDouble();
+    for (auto fps : rates)
+    {
+        a = new QAction(fps > 0. ? tr("%1 fps").arg(fps)
+                                 : tr("uncapped (benchmark)"), this);
+        a->setCheckable(true);
+        a->setChecked(qFuzzyCompare(fps + 1., rate + 1.));
+        m->addAction(a);
+        group->addAction(a);
+        connect(a, &QAction::triggered, [=]()
+        {
+            appSettings->setValue("RenderSettings/targetFps", fps);
+            renderer_->reconfigure();
+        });
+    }
+    m->addSeparator();
+    a = createRenderOptionAction_("vsync", tr("vsync (after restart)"));
+    m->addAction(a);
+
+    m->addSeparator();
+    a = new QAction(tr("start capture ..."), this);
+    m->addAction(a);
+    a->setShortcut(Qt::Key_F9);
+    connect(a, SIGNAL(triggered()), this, SLOT(slotStartCapture()));
+    a = new QAction(tr("stop capture"), this);
+    m->addAction(a);
+    a->setShortcut(Qt::SHIFT + Qt::Key_F9);
+    connect(a, SIGNAL(triggered()), renderer_, SLOT(stopCapture()));
+
     // --- help menu ---
     m = new QMenu(tr("&Help"), this);
     menuBar()->addMenu(m);
@@ -355,7 +494,66 @@ void MainWindow::updateUniformWidgets_()
     // delete the previous uniform widgets
     deleteUniformWidgets_();
 
-    if (shader_->numUniforms() <= 0)
+    // create a checkbox for each variant switch
+    const QStringList& switches = shader_->switches();
+    for (auto i = switches.begin(); i != switches.end(); ++i)
+    {
+        const QString name = *i;
+        auto cb = new QCheckBox("#define " + name, uniEdit_);
+        cb->setChecked(shader_->defines().contains(name));
+        cb->setStatusTip(tr("Compiles the shader variant with or without %1, "
+                            "previously used variants are switched instantly").arg(name));
+        connect(cb, &QCheckBox::toggled, [=](bool checked)
+        {
+            QStringList defines = shader_->defines();
+            if (checked)
+                defines << name;
+            else
+                defines.removeAll(name);
+            shader_->setDefines(defines);
+            compileShader();
+        });
+        uniEdit_->layout()->addWidget(cb);
+    }
+
+    // and a line edit for each define that takes a value
+    const QMap<QString, QString>& values = shader_->valueDefines();
+    for (auto i = values.begin(); i != values.end(); ++i)
+    {
+        const QString name = i.key();
+
+        auto w = new QWidget(uniEdit_);
+        auto l = new QHBoxLayout(w);
+        l->setMargin(0);
+        l->addWidget(new QLabel("#define " + name, w));
+
+        auto e = new QLineEdit(w);
+        l->addWidget(e);
+        e->setPlaceholderText(i.value().isEmpty() ? tr("undefined") : i.value());
+        const QString prefix = name + "=";
+        for (auto d = shader_->defines().begin(); d != shader_->defines().end(); ++d)
+            if (d->startsWith(prefix))
+                e->setText(d->mid(prefix.size()));
+        e->setStatusTip(tr("Compiles the shader variant with this value of %1, "
+                           "empty for the default").arg(name));
+        connect(e, &QLineEdit::editingFinished, [=]()
+        {
+            QStringList defines = shader_->defines();
+            for (int j = defines.size() - 1; j >= 0; --j)
+                if (defines[j] == name || defines[j].startsWith(prefix))
+                    defines.removeAt(j);
+            const QString value = e->text().trimmed();
+            if (!value.isEmpty())
+                defines << prefix + value;
+            if (defines == shader_->defines())
+                return;
+            shader_->setDefines(defines);
+            compileShader();
+        });
+        uniEdit_->layout()->addWidget(w);
+    }
+
+    if (shader_->numUniforms() <= 0 && switches.isEmpty() && values.isEmpty())
         return;
 
     // create the uniform widgets
@@ -411,8 +609,8 @@ void MainWindow::compileShader()
     // gray-out uniform editor
     uniEdit_->setEnabled(false);
 
-    shader_->setVertexSource(editVert_->toPlainText());
-    shader_->setFragmentSource(editFrag_->toPlainText());
+    shader_->setVertexSource(editVert_->toPlainText(), editVert_->filename());
+    shader_->setFragmentSource(editFrag_->toPlainText(), editFrag_->filename());
 
     // tell renderer to compile the shader
     renderer_->requestCompileShader();
@@ -422,6 +620,12 @@ void MainWindow::slotShaderCompiled()
 {
     log_->setText(shader_->log());
 
+    // watch the included files
+    if (!includeWatcher_->files().isEmpty())
+        includeWatcher_->removePaths(includeWatcher_->files());
+    if (!shader_->dependencies().isEmpty())
+        includeWatcher_->addPaths(shader_->dependencies().toList());
+
     // connect uniform updates
     if (shader_->ready())
     {
@@ -432,10 +636,40 @@ void MainWindow::slotShaderCompiled()
     }
 }
 
-void MainWindow::slotUniformChanged(Uniform * )
+void MainWindow::slotIncludeChanged(const QString& filename)
+{
+    shader_->fileChanged(filename);
+
+    // saving by renaming a new file over the old one drops the watch
+    if (!includeWatcher_->files().contains(filename) && QFileInfo(filename).exists())
+        includeWatcher_->addPath(filename);
+
+    // recompile if the current program includes the file
+    if (shader_->dependsOn(filename) && doAutoCompile_->isChecked())
+        compileShader();
+}
+
+void MainWindow::slotUniformChanged(Uniform * u)
 {
     //qDebug() << "changed uniform" << u->name() << u->floats[0] << u->floats[1] << u->floats[2];
-    renderer_->update();
+
+    // needs a new program
+    if (u->frozen())
+        refreezeTimer_->start();
+    else
+        renderer_->update();
+}
+
+void MainWindow::slotFreezeUniforms(bool freeze)
+{
+    refreezeTimer_->stop();
+
+    if (freeze)
+        shader_->freezeUniforms();
+    else
+        shader_->unfreezeUniforms();
+
+    compileShader();
 }
 
 void MainWindow::slotStatusMessage(const QString &text)
@@ -668,24 +902,45 @@ void MainWindow::slotLoadFragmentShader()
 
 void MainWindow::slotCreateModel()
 {
-    float scale = 5.f;
-
-    ModelFactory f;
-    Model * m;
+    ModelBuilder::Settings set;
 
     if (modelBox_->isChecked())
-        m = f.createCube(scale);
+        set.shape = ModelBuilder::Settings::S_BOX;
     else if (modelSphere_->isChecked())
-        m = f.createUVSphere(scale, 20, 20);
+        set.shape = ModelBuilder::Settings::S_SPHERE;
+    else if (modelGrid_->isChecked())
+        set.shape = ModelBuilder::Settings::S_GRID;
     else
-        m = f.createTeapot(scale/5);
+        set.shape = ModelBuilder::Settings::S_TEAPOT;
+
+    set.groupVertices = doGroupVertices_->isChecked();
+    set.weldVertices = doWeldVertices_->isChecked();
+    set.optimizeIndices = doOptimizeIndices_->isChecked();
+    set.layout = doInterleave_->isChecked() ?
+                     Model::L_INTERLEAVED : Model::L_SEPARATE;
+    set.format = doCompactFormat_->isChecked() ?
+                     Model::F_COMPACT : Model::F_FLOAT;
+
+    // the current model stays on screen until the new one is finished
+    modelBuilder_->build(set);
+}
 
-    if (!doGroupVertices_->isChecked())
-        m->unGroupVertices();
+void MainWindow::slotModelProgress(int percent)
+{
+    slotStatusMessage(tr("creating model %1%").arg(percent));
+}
 
+void MainWindow::slotModelFinished(Model * m, const QString& info)
+{
+    slotStatusMessage(info);
     renderer_->setModel(m);
 }
 
+void MainWindow::slotBenchmarkFinished(const QString& text)
+{
+    log_->append(text);
+}
+
 void MainWindow::slotHelp()
 {
     QString attribs = QString(
@@ -702,11 +957,14 @@ void MainWindow::slotHelp()
                 "mat4 %1;\t// projection matrix<br/>"
                 "mat4 %2;\t// transformation/view matrix<br/>"
                 "float %3;\t// aspect ratio (width divided by height)<br/>"
-                "float %4;\t// animation time in seconds")
+                "float %4;\t// animation time in seconds<br/><br/>"
+                "// or all of them in one uniform buffer:<br/>"
+                "layout(std140) uniform %5 { ... };")
             .arg(appSettings->getValue("ShaderUniforms/projection").toString())
             .arg(appSettings->getValue("ShaderUniforms/view").toString())
             .arg(appSettings->getValue("ShaderUniforms/aspect").toString())
-            .arg(appSettings->getValue("ShaderUniforms/time").toString());
+            .arg(appSettings->getValue("ShaderUniforms/time").toString())
+            .arg(appSettings->getValue("ShaderUniforms/frame").toString());
 
     QMessageBox::about(this, tr("Short help"),
         tr("<html>This program is basically a live shader editor.<br/>"
@@ -717,9 +975,21 @@ void MainWindow::slotHelp()
            "<p>uniforms:"
            "<pre>%2</pre></p>"
            "<p>All other uniforms that are defined and used in a shader "
-           "are automatically exposed to the user-interface as widgets.<br/>"
+           "are automatically exposed to the user-interface as widgets, "
+           "also the members of uniform blocks.<br/>"
            "The types of supported uniforms are currently:<br/>"
-           "<b>float, vec2, vec3, vec4</b> and <b>sampler2D</b>.</p>"
+           "<b>float, vec2, vec3, vec4, int</b> and <b>sampler2D</b>.</p>"
+           "<p>Symbols that the shader tests with <b>#ifdef</b>, <b>#ifndef</b> or "
+           "<b>defined()</b> appear as checkboxes. Symbols that are compared in "
+           "<b>#if</b>, like <i>#if STEPS &gt; 64</i>, or given a default with "
+           "<i>#ifndef STEPS / #define STEPS 64</i>, get a value field. "
+           "Each combination is compiled "
+           "as a separate variant with the <b>#define</b> inserted after the "
+           "#version line, and recently used variants stay linked for "
+           "instant switching.</p>"
+           "<p><b>Shader/Freeze uniforms</b> compiles the current uniform values "
+           "as constants into the shader. Editing a frozen uniform compiles "
+           "again after a short delay.</p>"
            "<p>The Renderwindow listens to some mouse commands to adjust the "
            "transformation matrix, these are: <b>left-drag</b> to rotate and "
            "<b>right-drag</b> to change the distance to the origin.</p>"
@@ -767,3 +1037,21 @@ void MainWindow::slotSelectImage(uint index)
         appSettings->setValue("image_path", QDir(fn).absolutePath());
     }
 }
+
+void MainWindow::slotStartCapture()
+{
+    QString fn =
+        QFileDialog::getSaveFileName(this,
+            tr("Capture frames to"),
+            appSettings->getValue("capture_file").toString(),
+            tr("PNG sequence (*.png);;"
+               "Raw RGBA sequence (*.rgba);;"
+               "YUV4MPEG2 video (*.y4m)"));
+
+    if (fn.isEmpty())
+        return;
+
+    appSettings->setValue("capture_file", fn);
+
+    renderer_->startCapture(fn);
+}
@@ -31,11 +31,15 @@ class QDockWidget;
 class QTextBrowser;
 class QAction;
 class QLabel;
+class QFileSystemWatcher;
+class QTimer;
 class RenderWidget;
 class SourceWidget;
 class Glsl;
 struct Uniform;
 class UniformWidgetFactory;
+class ModelBuilder;
+class Model;
 
 class MainWindow : public QMainWindow
 {
@@ -54,10 +58,14 @@ private slots:
     void compileShader();
     void slotSourceChanged();
     void slotShaderCompiled();
+    void slotIncludeChanged(const QString& filename);
 
     /** When a uniform is changed from a widget */
     void slotUniformChanged(Uniform *);
 
+    /** Bakes the current uniform values into the shader, or reverts */
+    void slotFreezeUniforms(bool freeze);
+
     void slotSaveShader();
     void slotSaveShaderAs();
     bool slotSaveVertexShaderAs();
@@ -68,6 +76,11 @@ private slots:
     void slotLoadFragmentShader();
 
     void slotCreateModel();
+    void slotModelProgress(int percent);
+    void slotModelFinished(Model *, const QString& info);
+
+    /** Appends the benchmark result to the log view */
+    void slotBenchmarkFinished(const QString&);
 
     void slotUpdateSourceTitles();
 
@@ -80,6 +93,9 @@ private slots:
 
     void slotSelectImage(uint index);
 
+    /** Asks for a file and starts recording the rendered frames */
+    void slotStartCapture();
+
 private:
     /** Creates all the main widgets */
     void createWidgets_();
@@ -111,6 +127,10 @@ private:
 
     QWidget * uniEdit_;
     UniformWidgetFactory * uniFactory_;
+    ModelBuilder * modelBuilder_;
+    QFileSystemWatcher * includeWatcher_;
+    /** delays re-freezing while frozen uniforms are edited */
+    QTimer * refreezeTimer_;
     QLabel * statusLabel_;
 
     QTextBrowser * log_;
@@ -123,10 +143,16 @@ private:
             * stopAnim_,
             * saveAll_,
             * doAutoCompile_,
+            * doFreezeUniforms_,
             * doGroupVertices_,
+            * doWeldVertices_,
+            * doInterleave_,
+            * doCompactFormat_,
+            * doOptimizeIndices_,
             * modelBox_,
             * modelSphere_,
-            * modelPot_;
+            * modelPot_,
+            * modelGrid_;
 };
 
 #endif // MAINWINDOW_H
@@ -18,10 +18,65 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 ****************************************************************************/
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
 #include "model.h"
 #include "vector.h"
+#include "parallel.h"
 #include "debug.h"
 
+namespace {
+
+    /** Converts a float to a 16 bit half float (round to nearest) */
+    GLushort toHalf(float f)
+    {
+        GLuint x;
+        memcpy(&x, &f, 4);
+
+        const GLuint sign = (x >> 16) & 0x8000;
+        const int exp = int((x >> 23) & 0xff) - 127 + 15;
+        GLuint mant = x & 0x7fffff;
+
+        // nan and inf
+        if (((x >> 23) & 0xff) == 0xff)
+            return sign | 0x7c00 | (mant ? 0x200 : 0);
+        // overflow to inf
+        if (exp >= 31)
+            return sign | 0x7c00;
+        // denormals and underflow to zero
+        if (exp <= 0)
+        {
+            if (exp < -10)
+                return sign;
+            mant |= 0x800000;
+            const int shift = 14 - exp;
+            return sign | ((mant + (1 << (shift - 1))) >> shift);
+        }
+        // round mantissa (may carry into the exponent, which is correct)
+        return (sign | (exp << 10) | (mant >> 13)) + ((mant >> 12) & 1);
+    }
+
+    /** Converts a float in [-1,1] to a signed 10 bit value */
+    GLuint toSnorm10(float f)
+    {
+        f = std::max(-1.f, std::min(1.f, f));
+        const int i = int(std::floor(f * 511.f + 0.5f));
+        return GLuint(i) & 0x3ff;
+    }
+
+    /** Converts a float in [0,1] to an unsigned byte */
+    GLubyte toUnorm8(float f)
+    {
+        f = std::max(0.f, std::min(1.f, f));
+        return GLubyte(f * 255.f + 0.5f);
+    }
+
+} // namespace
+
 Model::Model()
     :   curR_   (.5f),
         curG_   (.5f),
@@ -32,11 +87,21 @@ Model::Model()
         curNz_  (1.f),
         curU_   (0.f),
         curV_   (0.f),
-        isVAO_  (false)
+        layout_ (L_SEPARATE),
+        format_ (F_FLOAT),
+        indexBuffer_(0),
+        vao_    (0),
+        numIndices_(0),
+        indexEnum_(IndexEnum),
+        bufferLayout_(L_SEPARATE),
+        bufferFormat_(F_FLOAT),
+        isVAO_  (false),
+        isBuffer_(false)
 #ifdef SCH_USE_QT_OPENGLFUNC
         ,isGlFuncInitialized_(false)
 #endif
 {
+    buffers_[0] = buffers_[1] = buffers_[2] = buffers_[3] = 0;
 }
 
 void Model::clear()
@@ -73,6 +138,38 @@ Model::IndexType Model::addVertex(
     return numVertices() - 1;
 }
 
+size_t Model::vertexSize() const
+{
+    return attribSize_(A_POSITION)
+         + attribSize_(A_NORMAL)
+         + attribSize_(A_COLOR)
+         + attribSize_(A_TEXCOORD);
+}
+
+GLenum Model::indexEnum() const
+{
+    return numVertices() < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t Model::indexSize() const
+{
+    return indexEnum() == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+size_t Model::memoryGPU() const
+{
+    return numVertices() * vertexSize() + index_.size() * indexSize();
+}
+
+size_t Model::memoryCPU() const
+{
+    return vertex_.size() * sizeof(VertexType)
+         + normal_.size() * sizeof(NormalType)
+         + color_.size() * sizeof(ColorType)
+         + texcoord_.size() * sizeof(TextureCoordType)
+         + index_.size() * sizeof(IndexType);
+}
+
 void Model::addTriangle(IndexType p1, IndexType p2, IndexType p3)
 {
     index_.push_back(p1);
@@ -80,104 +177,615 @@ void Model::addTriangle(IndexType p1, IndexType p2, IndexType p3)
     index_.push_back(p3);
 }
 
+void Model::reserve(size_t numVertices, size_t numTriangles)
+{
+    vertex_.reserve(numVertices * 3);
+    normal_.reserve(numVertices * 3);
+    color_.reserve(numVertices * 4);
+    texcoord_.reserve(numVertices * 2);
+    index_.reserve(numTriangles * 3);
+}
+
+Model::VertexSpan Model::appendVertices(size_t num)
+{
+    VertexSpan s;
+    s.first = numVertices();
+    s.num = num;
+
+    const size_t nv = s.first + num;
+    vertex_.resize(nv * 3);
+    normal_.resize(nv * 3);
+    color_.resize(nv * 4);
+    texcoord_.resize(nv * 2);
+
+    s.position = &vertex_[s.first * 3];
+    s.normal = &normal_[s.first * 3];
+    s.color = &color_[s.first * 4];
+    s.texcoord = &texcoord_[s.first * 2];
+
+    // fill with current state
+    for (size_t i=0; i<num; ++i)
+    {
+        s.normal[i*3  ] = curNx_;
+        s.normal[i*3+1] = curNy_;
+        s.normal[i*3+2] = curNz_;
+        s.color[i*4  ] = curR_;
+        s.color[i*4+1] = curG_;
+        s.color[i*4+2] = curB_;
+        s.color[i*4+3] = curA_;
+        s.texcoord[i*2  ] = curU_;
+        s.texcoord[i*2+1] = curV_;
+    }
+
+    return s;
+}
+
+Model::IndexType * Model::appendTriangles(size_t num)
+{
+    const size_t first = index_.size();
+    index_.resize(first + num * 3);
+    return &index_[first];
+}
 
-void Model::calculateTriangleNormals()
+Model::IndexType Model::addVertices(size_t num, const VertexType * position,
+                                    const NormalType * normal,
+                                    const ColorType * color,
+                                    const TextureCoordType * texcoord)
 {
-    // first clear the normal array
+    VertexSpan s = appendVertices(num);
+
+    memcpy(s.position, position, num * 3 * sizeof(VertexType));
+    if (normal)
+        memcpy(s.normal, normal, num * 3 * sizeof(NormalType));
+    if (color)
+        memcpy(s.color, color, num * 4 * sizeof(ColorType));
+    if (texcoord)
+        memcpy(s.texcoord, texcoord, num * 2 * sizeof(TextureCoordType));
+
+    return s.first;
+}
+
+void Model::addTriangles(size_t num, const IndexType * indices, IndexType offset)
+{
+    IndexType * dst = appendTriangles(num);
+    for (size_t i=0; i<num * 3; ++i)
+        dst[i] = indices[i] + offset;
+}
+
+
+void Model::calculateTriangleNormals(NormalWeighting weighting, bool multiThreaded)
+{
+    const size_t nt = numTriangles(),
+                 nv = numVertices();
+
+    // --- triangle normals (and corner weights) ---
+
+    // struct-of-arrays, so the math below vectorizes
+    // (with the flags in scheeder.pro)
+    std::vector<float> fx(nt), fy(nt), fz(nt);
+    // weight of each triangle corner, for angle weighting
+    std::vector<float> cornerWeight(weighting == NW_ANGLE ? nt * 3 : 0);
+
+    auto faces = [&](size_t begin, size_t end)
+    {
+        // process in small batches:
+        // gather the corner positions, then do the math on plain arrays
+        const size_t B = 64;
+        float e1x[B], e1y[B], e1z[B], e2x[B], e2y[B], e2z[B],
+              nx[B], ny[B], nz[B], len[B];
+
+        for (size_t b = begin; b < end; b += B)
+        {
+            const size_t num = std::min(B, end - b);
+
+            for (size_t j=0; j<num; ++j)
+            {
+                const IndexType * i = &index_[(b+j)*3];
+                const VertexType
+                        * p1 = &vertex_[i[0]*3],
+                        * p2 = &vertex_[i[1]*3],
+                        * p3 = &vertex_[i[2]*3];
+                e1x[j] = p2[0] - p1[0]; e1y[j] = p2[1] - p1[1]; e1z[j] = p2[2] - p1[2];
+                e2x[j] = p3[0] - p1[0]; e2y[j] = p3[1] - p1[1]; e2z[j] = p3[2] - p1[2];
+            }
+
+            // cross product, it's length is twice the area
+            for (size_t j=0; j<num; ++j)
+            {
+                nx[j] = e1y[j] * e2z[j] - e1z[j] * e2y[j];
+                ny[j] = e1z[j] * e2x[j] - e1x[j] * e2z[j];
+                nz[j] = e1x[j] * e2y[j] - e1y[j] * e2x[j];
+                len[j] = std::sqrt(nx[j] * nx[j] + ny[j] * ny[j] + nz[j] * nz[j]);
+            }
+
+            // area weighting keeps the length, others use the unit normal
+            if (weighting != NW_AREA)
+                for (size_t j=0; j<num; ++j)
+                {
+                    const float f = len[j] > 0.f ? 1.f / len[j] : 0.f;
+                    nx[j] *= f; ny[j] *= f; nz[j] *= f;
+                }
+
+            for (size_t j=0; j<num; ++j)
+            {
+                fx[b+j] = nx[j];
+                fy[b+j] = ny[j];
+                fz[b+j] = nz[j];
+            }
+
+            if (weighting == NW_ANGLE)
+                for (size_t j=0; j<num; ++j)
+                {
+                    const IndexType * i = &index_[(b+j)*3];
+                    for (int k=0; k<3; ++k)
+                    {
+                        // the two edges leaving the corner
+                        const VertexType
+                                * p = &vertex_[i[k]*3],
+                                * q = &vertex_[i[(k+1)%3]*3],
+                                * r = &vertex_[i[(k+2)%3]*3];
+                        const Vec3 a(q[0]-p[0], q[1]-p[1], q[2]-p[2]),
+                                   c(r[0]-p[0], r[1]-p[1], r[2]-p[2]);
+                        const float l = glm::length(a) * glm::length(c);
+                        cornerWeight[(b+j)*3+k] = l > 0.f
+                            ? std::acos(std::max(-1.f, std::min(1.f, glm::dot(a, c) / l)))
+                            : 0.f;
+                    }
+                }
+        }
+    };
+
+    // --- vertex -> triangle-corner adjacency ---
+
+    std::vector<IndexType> offset(nv + 1, 0);
+    for (size_t i=0; i<index_.size(); ++i)
+        offset[index_[i]+1]++;
+    for (size_t v=0; v<nv; ++v)
+        offset[v+1] += offset[v];
+
+    std::vector<IndexType> corners(index_.size());
+    {
+        std::vector<IndexType> fill(offset.begin(), offset.end() - 1);
+        for (size_t i=0; i<index_.size(); ++i)
+            corners[fill[index_[i]]++] = i;
+    }
+
+    // --- sum up the adjacent triangle normals for each vertex ---
+
     normal_.resize(vertex_.size());
-    for (size_t i=0; i<normal_.size(); ++i)
-        normal_[i] = 0;
-
-    // an array to memorize the number of
-    // adjacent vertices for each vertex
-    std::vector<size_t> nr_adds(numVertices());
-
-    // for each triangle
-    for (size_t i=0; i<index_.size()/3; ++i)
-    {
-        // index of each triangle corner
-        size_t
-            v1 = index_[i*3],
-            v2 = index_[i*3+1],
-            v3 = index_[i*3+2];
-        // vector of each triangle corner
-        Vec3
-            p1 = Vec3(vertex_[v1*3], vertex_[v1*3+1], vertex_[v1*3+2]),
-            p2 = Vec3(vertex_[v2*3], vertex_[v2*3+1], vertex_[v2*3+2]),
-            p3 = Vec3(vertex_[v3*3], vertex_[v3*3+1], vertex_[v3*3+2]);
-
-        // calculate the normal of the triangle
-        Vec3 n = glm::normalize( glm::cross( p2-p1, p3-p1 ) );
-
-        // copy/add to normals array
-        normal_[v1*3  ] += n[0];
-        normal_[v1*3+1] += n[1];
-        normal_[v1*3+2] += n[2];
-        normal_[v2*3  ] += n[0];
-        normal_[v2*3+1] += n[1];
-        normal_[v2*3+2] += n[2];
-        normal_[v3*3  ] += n[0];
-        normal_[v3*3+1] += n[1];
-        normal_[v3*3+2] += n[2];
-
-        // memorize the count
-        nr_adds[v1]++;
-        nr_adds[v2]++;
-        nr_adds[v3]++;
+
+    auto sumNormals = [&](size_t begin, size_t end)
+    {
+        for (size_t v = begin; v < end; ++v)
+        {
+            float x = 0.f, y = 0.f, z = 0.f;
+            for (IndexType j = offset[v]; j < offset[v+1]; ++j)
+            {
+                const IndexType c = corners[j],
+                                t = c / 3;
+                const float w = weighting == NW_ANGLE ? cornerWeight[c] : 1.f;
+                x += w * fx[t];
+                y += w * fy[t];
+                z += w * fz[t];
+            }
+
+            // renormalize (unused vertices get a zero normal)
+            const float len = std::sqrt(x * x + y * y + z * z),
+                        f = len > 0.f ? 1.f / len : 0.f;
+            normal_[v*3  ] = x * f;
+            normal_[v*3+1] = y * f;
+            normal_[v*3+2] = z * f;
+        }
+    };
+
+    if (multiThreaded)
+    {
+        parallelFor(nt, faces);
+        parallelFor(nv, sumNormals);
+    }
+    else
+    {
+        faces(0, nt);
+        sumNormals(0, nv);
+    }
+}
+
+void Model::unGroupVertices(bool multiThreaded)
+{
+    const size_t nt = numTriangles(),
+                 nv = nt * 3;
+
+    // the new data, each allocated once
+    std::vector<VertexType>       vertex(nv * 3);
+    std::vector<NormalType>       normal(nv * 3);
+    std::vector<ColorType>        color(nv * 4);
+    std::vector<TextureCoordType> texcoord(nv * 2);
+
+    // gathers the corners of the triangles [begin, end)
+    // and writes the triangle normal to each corner
+    // (which is what calculateTriangleNormals() would give)
+    auto gather = [&](size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; ++t)
+        {
+            const IndexType i[3] = { index_[t*3], index_[t*3+1], index_[t*3+2] };
+
+            for (int k=0; k<3; ++k)
+            {
+                const size_t j = t*3 + k;
+                memcpy(&vertex[j*3], &vertex_[i[k]*3], 3 * sizeof(VertexType));
+                memcpy(&color[j*4], &color_[i[k]*4], 4 * sizeof(ColorType));
+                memcpy(&texcoord[j*2], &texcoord_[i[k]*2], 2 * sizeof(TextureCoordType));
+            }
+
+            const VertexType * p = &vertex[t*9];
+            const Vec3 n = glm::normalize( glm::cross(
+                        Vec3(p[3]-p[0], p[4]-p[1], p[5]-p[2]),
+                        Vec3(p[6]-p[0], p[7]-p[1], p[8]-p[2]) ));
+            for (int k=0; k<3; ++k)
+            {
+                normal[t*9+k*3  ] = n[0];
+                normal[t*9+k*3+1] = n[1];
+                normal[t*9+k*3+2] = n[2];
+            }
+
+            // every corner is it's own vertex now
+            index_[t*3  ] = t*3;
+            index_[t*3+1] = t*3+1;
+            index_[t*3+2] = t*3+2;
+        }
+    };
+
+    if (multiThreaded)
+        parallelFor(nt, gather);
+    else
+        gather(0, nt);
+
+    vertex_.swap(vertex);
+    normal_.swap(normal);
+    color_.swap(color);
+    texcoord_.swap(texcoord);
+}
+
+int Model::weldVertices(float epsilon)
+{
+    const int nv = numVertices();
+    if (!nv)
+        return 0;
+
+    // Vertices are sorted into a hash grid of their positions.
+    // Each vertex is compared against the vertices
+    // in it's own and the 26 neighbouring cells,
+    // so near-identical vertices are found across cell borders.
+
+    const double cell = epsilon > 0.f ? epsilon : 1e-6;
+
+    // Cell coordinates are clamped well inside the int64 range,
+    // so the neighbour cells can not overflow either.
+    // Far away vertices share the border cells which is just slower.
+    const double maxCell = 1e15;
+    auto quantize = [&](VertexType c)
+    {
+        return (int64_t)std::max(-maxCell, std::min(maxCell, std::floor(c / cell)));
+    };
+    auto cellOf = [&](int v, int64_t & cx, int64_t & cy, int64_t & cz)
+    {
+        cx = quantize(vertex_[v*3  ]);
+        cy = quantize(vertex_[v*3+1]);
+        cz = quantize(vertex_[v*3+2]);
+    };
+    auto hashOf = [](int64_t cx, int64_t cy, int64_t cz)
+    {
+        return ((size_t)cx * 73856093u) ^ ((size_t)cy * 19349663u) ^ ((size_t)cz * 83492791u);
+    };
+    auto isFinite = [&](int v)
+    {
+        return std::isfinite(vertex_[v*3]) && std::isfinite(vertex_[v*3+1])
+            && std::isfinite(vertex_[v*3+2]);
+    };
+    auto equal = [&](int a, int b)
+    {
+        // (written as !(x <= eps) to treat NaNs as different)
+        for (int i=0; i<3; ++i)
+            if (!(std::abs(vertex_[a*3+i] - vertex_[b*3+i]) <= epsilon)
+             || !(std::abs(normal_[a*3+i] - normal_[b*3+i]) <= epsilon))
+                return false;
+        for (int i=0; i<4; ++i)
+            if (!(std::abs(color_[a*4+i] - color_[b*4+i]) <= epsilon))
+                return false;
+        for (int i=0; i<2; ++i)
+            if (!(std::abs(texcoord_[a*2+i] - texcoord_[b*2+i]) <= epsilon))
+                return false;
+        return true;
+    };
+
+    // hashed cell -> first unique vertex in the cell,
+    // further vertices of the cell (or of colliding cells) are chained
+    std::unordered_map<size_t, int> grid;
+    grid.reserve(nv);
+    std::vector<int> chain;
+    chain.reserve(nv);
+
+    // old vertex -> new vertex
+    std::vector<IndexType> remap(nv);
+    // new vertex -> old vertex
+    std::vector<int> unique;
+    unique.reserve(nv);
+
+    for (int v=0; v<nv; ++v)
+    {
+        // NaN or infinite positions never equal anything,
+        // keep them as they are
+        if (!isFinite(v))
+        {
+            remap[v] = unique.size();
+            unique.push_back(v);
+            chain.push_back(-1);
+            continue;
+        }
+
+        int64_t cx, cy, cz;
+        cellOf(v, cx, cy, cz);
+
+        // search for an equal vertex in neighbourhood
+        int found = -1;
+        for (int64_t z=cz-1; z<=cz+1 && found < 0; ++z)
+        for (int64_t y=cy-1; y<=cy+1 && found < 0; ++y)
+        for (int64_t x=cx-1; x<=cx+1 && found < 0; ++x)
+        {
+            auto it = grid.find(hashOf(x, y, z));
+            if (it == grid.end())
+                continue;
+            for (int u = it->second; u >= 0; u = chain[u])
+                if (equal(unique[u], v))
+                {
+                    found = u;
+                    break;
+                }
+        }
+
+        if (found >= 0)
+        {
+            remap[v] = found;
+            continue;
+        }
+
+        // add as new unique vertex
+        const int u = unique.size();
+        unique.push_back(v);
+        remap[v] = u;
+
+        auto it = grid.find(hashOf(cx, cy, cz));
+        if (it == grid.end())
+        {
+            chain.push_back(-1);
+            grid.insert(std::make_pair(hashOf(cx, cy, cz), u));
+        }
+        else
+        {
+            chain.push_back(it->second);
+            it->second = u;
+        }
     }
 
-    // finally normalize the normals :)
-    for (size_t i=0; i<normal_.size(); ++i)
+    const int nu = unique.size();
+    if (nu == nv)
+        return 0;
+
+    // compact the vertex data
+    for (int u=0; u<nu; ++u)
     {
-        if (nr_adds[i/3])
-            normal_[i] /= nr_adds[i/3];
+        const int v = unique[u];
+        if (u == v)
+            continue;
+        memmove(&vertex_[u*3], &vertex_[v*3], 3 * sizeof(VertexType));
+        memmove(&normal_[u*3], &normal_[v*3], 3 * sizeof(NormalType));
+        memmove(&color_[u*4], &color_[v*4], 4 * sizeof(ColorType));
+        memmove(&texcoord_[u*2], &texcoord_[v*2], 2 * sizeof(TextureCoordType));
     }
+    vertex_.resize(nu * 3);
+    normal_.resize(nu * 3);
+    color_.resize(nu * 4);
+    texcoord_.resize(nu * 2);
 
+    // rebuild the triangles, without the degenerated ones
+    size_t j = 0;
+    for (size_t i=0; i<index_.size(); i += 3)
+    {
+        const IndexType
+            i1 = remap[index_[i]],
+            i2 = remap[index_[i+1]],
+            i3 = remap[index_[i+2]];
+        if (i1 == i2 || i2 == i3 || i1 == i3)
+            continue;
+        index_[j++] = i1;
+        index_[j++] = i2;
+        index_[j++] = i3;
+    }
+    index_.resize(j);
+
+    return nv - nu;
 }
 
-void Model::unGroupVertices()
+
+// ---------------------- optimization ------------------------------------
+
+float Model::acmr(int cacheSize) const
 {
-    // backup data
-    auto vertex = vertex_;
-    auto normal = normal_;
-    auto color = color_;
-    auto texcoord = texcoord_;
-    auto index = index_;
+    return acmr_(index_, cacheSize);
+}
 
-    vertex_.clear();
-    normal_.clear();
-    color_.clear();
-    index_.clear();
-    texcoord_.clear();
+float Model::acmr_(const std::vector<IndexType>& index, int cacheSize) const
+{
+    if (index.size() < 3)
+        return 0.f;
 
-    // for each previous triangle ..
-    for (uint i=0; i<index.size()/3; ++i)
-    {
-        IndexType
-            i1 = index[i*3],
-            i2 = index[i*3+1],
-            i3 = index[i*3+2],
-
-            t1 = addVertex(vertex[i1*3], vertex[i1*3+1], vertex[i1*3+2],
-                           normal[i1*3], normal[i1*3+1], normal[i1*3+2],
-                           color[i1*4], color[i1*4+1], color[i1*4+2], color[i1*4+3],
-                           texcoord[i1*2], texcoord[i1*2+1]),
-            t2 = addVertex(vertex[i2*3], vertex[i2*3+1], vertex[i2*3+2],
-                           normal[i2*3], normal[i2*3+1], normal[i2*3+2],
-                           color[i2*4], color[i2*4+1], color[i2*4+2], color[i2*4+3],
-                           texcoord[i2*2], texcoord[i2*2+1]),
-            t3 = addVertex(vertex[i3*3], vertex[i3*3+1], vertex[i3*3+2],
-                           normal[i3*3], normal[i3*3+1], normal[i3*3+2],
-                           color[i3*4], color[i3*4+1], color[i3*4+2], color[i3*4+3],
-                           texcoord[i3*2], texcoord[i3*2+1]);
-
-        // .. create a new unique triangle
-        addTriangle(t1, t2, t3);
+    // FIFO cache simulation:
+    // a vertex is in the cache when it was inserted
+    // less than cacheSize misses ago
+    std::vector<long> stamp(numVertices(), -1);
+    long misses = 0;
+
+    for (size_t i=0; i<index.size(); ++i)
+    {
+        const IndexType v = index[i];
+        if (stamp[v] < 0 || misses - stamp[v] >= cacheSize)
+            stamp[v] = misses++;
     }
 
-    // recalculate the normals
-    // to show difference between shared and un-shared vertices
-    calculateTriangleNormals();
+    return (float)misses / (index.size() / 3);
+}
+
+void Model::optimizeIndices(int cacheSize)
+{
+    const int nv = numVertices(),
+              nt = numTriangles();
+    if (!nt)
+        return;
+
+    // --- vertex-triangle adjacency ---
+
+    // number of (not yet emitted) triangles using each vertex
+    std::vector<int> live(nv, 0);
+    for (size_t i=0; i<index_.size(); ++i)
+        live[index_[i]]++;
+
+    // offsets into the adjacency list
+    std::vector<int> offset(nv + 1, 0);
+    for (int v=0; v<nv; ++v)
+        offset[v+1] = offset[v] + live[v];
+
+    // triangles of each vertex
+    std::vector<int> adjacency(index_.size());
+    {
+        std::vector<int> fill(offset.begin(), offset.end() - 1);
+        for (size_t i=0; i<index_.size(); ++i)
+            adjacency[fill[index_[i]]++] = i / 3;
+    }
+
+    // --- tipsify ---
+
+    std::vector<IndexType> index;
+    index.reserve(index_.size());
+
+    std::vector<int> cacheTime(nv, 0);
+    std::vector<bool> emitted(nt, false);
+    std::vector<int> deadEnd, candidates;
+    deadEnd.reserve(index_.size());
+
+    int time = cacheSize + 1,
+        cursor = 0;
+
+    // start with the first used vertex
+    while (cursor < nv && live[cursor] <= 0)
+        ++cursor;
+    int fan = cursor < nv ? cursor : -1;
+
+    while (fan >= 0)
+    {
+        candidates.clear();
+
+        // emit all remaining triangles around the fanning vertex
+        for (int j = offset[fan]; j < offset[fan+1]; ++j)
+        {
+            const int t = adjacency[j];
+            if (emitted[t])
+                continue;
+
+            for (int k=0; k<3; ++k)
+            {
+                const IndexType v = index_[t*3+k];
+                index.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                // not in cache anymore?
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // choose the next fanning vertex among the candidates:
+        // the oldest one that will still be in the cache
+        // after emitting it's remaining triangles
+        fan = -1;
+        int best = -1;
+        for (size_t j=0; j<candidates.size(); ++j)
+        {
+            const int v = candidates[j];
+            if (live[v] <= 0)
+                continue;
+
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = time - cacheTime[v];
+
+            if (priority > best)
+            {
+                best = priority;
+                fan = v;
+            }
+        }
+
+        // dead-end: go back to recently used vertices
+        while (fan < 0 && !deadEnd.empty())
+        {
+            const int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                fan = v;
+        }
+
+        // or continue with the next vertex in input order
+        if (fan < 0)
+        {
+            while (cursor < nv && live[cursor] <= 0)
+                ++cursor;
+            if (cursor < nv)
+                fan = cursor;
+        }
+    }
+
+    // keep the original order if it was already better
+    if (acmr_(index, cacheSize) < acmr_(index_, cacheSize))
+        index_.swap(index);
+
+    // --- reorder vertices in order of first use ---
+
+    const IndexType unused = (IndexType)-1;
+    std::vector<IndexType> remap(nv, unused);
+    IndexType next = 0;
+    for (size_t i=0; i<index_.size(); ++i)
+    {
+        IndexType & r = remap[index_[i]];
+        if (r == unused)
+            r = next++;
+        index_[i] = r;
+    }
+    // keep unreferenced vertices at the end
+    for (int v=0; v<nv; ++v)
+        if (remap[v] == unused)
+            remap[v] = next++;
+
+    std::vector<VertexType> vertex(vertex_.size());
+    std::vector<NormalType> normal(normal_.size());
+    std::vector<ColorType> color(color_.size());
+    std::vector<TextureCoordType> texcoord(texcoord_.size());
+
+    for (int v=0; v<nv; ++v)
+    {
+        const IndexType r = remap[v];
+        memcpy(&vertex[r*3], &vertex_[v*3], 3 * sizeof(VertexType));
+        memcpy(&normal[r*3], &normal_[v*3], 3 * sizeof(NormalType));
+        memcpy(&color[r*4], &color_[v*4], 4 * sizeof(ColorType));
+        memcpy(&texcoord[r*2], &texcoord_[v*2], 2 * sizeof(TextureCoordType));
+    }
+
+    vertex_.swap(vertex);
+    normal_.swap(normal);
+    color_.swap(color);
+    texcoord_.swap(texcoord);
 }
 
 
@@ -188,6 +796,19 @@ void Model::unGroupVertices()
 
 void Model::setShaderLocations(const ShaderLocations &v)
 {
+    // buffers in an outdated layout/format need to be uploaded again
+    if (isBuffer_ && (bufferLayout_ != layout_ || bufferFormat_ != format_))
+        releaseGL();
+
+    // the buffers stay the same, only the
+    // attribute bindings in the vao need to change
+    if (isVAO_
+        && attribs_.position == v.position
+        && attribs_.normal == v.normal
+        && attribs_.color == v.color
+        && attribs_.texcoord == v.texcoord)
+        return;
+
     attribs_ = v;
     createVAO_();
 }
@@ -204,8 +825,9 @@ void Model::draw()
     SCH_CHECK_GL( glBindVertexArray(vao_) );
 #endif
 
-    //SCH_CHECK_GL( glDrawArrays(GL_TRIANGLES, 0, vertex_.size()/3) );
-    SCH_CHECK_GL( glDrawElements(GL_TRIANGLES, index_.size(), IndexEnum, &index_[0]) );
+    // the element buffer is part of the vertex array object
+    if (numIndices_)
+        SCH_CHECK_GL( glDrawElements(GL_TRIANGLES, numIndices_, indexEnum_, (const GLvoid*)0) );
 
 #ifdef __APPLE__
     SCH_CHECK_GL( glBindVertexArrayAPPLE(0) );
@@ -220,17 +842,35 @@ void Model::drawOldschool()
     initQtOpenGl_();
 #endif
 
+    // buffers in an outdated layout/format need to be uploaded again
+    if (isBuffer_ && (bufferLayout_ != layout_ || bufferFormat_ != format_))
+        releaseGL();
+
+    // upload once, then draw from the buffers
+    if (!isBuffer_)
+        createBuffers_();
+
     SCH_CHECK_GL( glEnableClientState(GL_COLOR_ARRAY) );
     SCH_CHECK_GL( glEnableClientState(GL_NORMAL_ARRAY) );
     SCH_CHECK_GL( glEnableClientState(GL_VERTEX_ARRAY) );
     SCH_CHECK_GL( glEnableClientState(GL_TEXTURE_COORD_ARRAY) );
 
-    SCH_CHECK_GL( glVertexPointer(3, VertexEnum, 0, &vertex_[0]) );
-    SCH_CHECK_GL( glNormalPointer(NormalEnum, 0, &normal_[0]) );
-    SCH_CHECK_GL( glColorPointer(4, ColorEnum,  0, &color_[0]) );
-    SCH_CHECK_GL( glTexCoordPointer(2, TextureCoordEnum,  0, &texcoord_[0]) );
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_POSITION)) );
+    SCH_CHECK_GL( glVertexPointer(attribComponents_(A_POSITION), attribEnum_(A_POSITION), attribStride_(A_POSITION), attribOffset_(A_POSITION)) );
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_NORMAL)) );
+    SCH_CHECK_GL( glNormalPointer(attribEnum_(A_NORMAL), attribStride_(A_NORMAL), attribOffset_(A_NORMAL)) );
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_COLOR)) );
+    SCH_CHECK_GL( glColorPointer(attribComponents_(A_COLOR), attribEnum_(A_COLOR), attribStride_(A_COLOR), attribOffset_(A_COLOR)) );
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_TEXCOORD)) );
+    SCH_CHECK_GL( glTexCoordPointer(attribComponents_(A_TEXCOORD), attribEnum_(A_TEXCOORD), attribStride_(A_TEXCOORD), attribOffset_(A_TEXCOORD)) );
 
-    SCH_CHECK_GL( glDrawElements(GL_TRIANGLES, index_.size(), IndexEnum, &index_[0]) );
+    SCH_CHECK_GL( glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_) );
+    if (numIndices_)
+        SCH_CHECK_GL( glDrawElements(GL_TRIANGLES, numIndices_, indexEnum_, (const GLvoid*)0) );
+
+    // unbind, so that following client-side arrays still work
+    SCH_CHECK_GL( glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0) );
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, 0) );
 
     SCH_CHECK_GL( glDisableClientState(GL_TEXTURE_COORD_ARRAY) );
     SCH_CHECK_GL( glDisableClientState(GL_VERTEX_ARRAY) );
@@ -245,19 +885,32 @@ void Model::releaseGL()
     initQtOpenGl_();
 #endif
 
-#ifdef __APPLE__
-    if (glIsVertexArrayAPPLE(vao_))
+    releaseVAO_();
+
+    if (isBuffer_)
     {
-        SCH_CHECK_GL( glDeleteVertexArraysAPPLE(1, &vao_) );
+        // (glDeleteBuffers silently ignores zero names)
         SCH_CHECK_GL( glDeleteBuffers(4, buffers_) );
+        SCH_CHECK_GL( glDeleteBuffers(1, &indexBuffer_) );
     }
+
+    indexBuffer_ = 0;
+    buffers_[0] = buffers_[1] = buffers_[2] = buffers_[3] = 0;
+
+    isBuffer_ = false;
+}
+
+void Model::releaseVAO_()
+{
+#ifdef __APPLE__
+    if (isVAO_ && glIsVertexArrayAPPLE(vao_))
+        SCH_CHECK_GL( glDeleteVertexArraysAPPLE(1, &vao_) );
 #else
-    if (glIsVertexArray(vao_))
-    {
+    if (isVAO_ && glIsVertexArray(vao_))
         SCH_CHECK_GL( glDeleteVertexArrays(1, &vao_) );
-        SCH_CHECK_GL( glDeleteBuffers(4, buffers_) );
-    }
 #endif
+
+    vao_ = 0;
     isVAO_ = false;
 }
 
@@ -267,8 +920,8 @@ void Model::createVAO_()
     initQtOpenGl_();
 #endif
 
-    // delete previous
-    releaseGL();
+    // delete previous vao, but keep the buffers
+    releaseVAO_();
 
     // create the object
 #ifdef __APPLE__
@@ -283,45 +936,251 @@ void Model::createVAO_()
     SCH_CHECK_GL( glBindVertexArray(vao_) );
 #endif
 
-    // create buffers for vertex/color/normal/texcoord
+    // upload once
+    if (!isBuffer_)
+        createBuffers_();
 
-    SCH_CHECK_GL( glGenBuffers(4, buffers_) );
+    // connect the buffers to the shader attributes
 
     if ((int)attribs_.position>=0)
     {
-        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[0]) );
-        SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, vertex_.size() * sizeof(VertexType), &vertex_[0], GL_STATIC_DRAW) );
+        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_POSITION)) );
         SCH_CHECK_GL( glEnableVertexAttribArray(attribs_.position) );
-        SCH_CHECK_GL( glVertexAttribPointer(attribs_.position, 3, VertexEnum, GL_FALSE, 0, NULL) );
+        SCH_CHECK_GL( glVertexAttribPointer(attribs_.position,
+                        attribComponents_(A_POSITION), attribEnum_(A_POSITION), attribNormalized_(A_POSITION),
+                        attribStride_(A_POSITION), attribOffset_(A_POSITION)) );
     }
 
     if ((int)attribs_.normal>=0)
     {
-        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[1]) );
-        SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, normal_.size() * sizeof(NormalType), &normal_[0], GL_STATIC_DRAW) );
+        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_NORMAL)) );
         SCH_CHECK_GL( glEnableVertexAttribArray(attribs_.normal) );
-        SCH_CHECK_GL( glVertexAttribPointer(attribs_.normal, 3, NormalEnum, GL_FALSE, 0, NULL) );
+        SCH_CHECK_GL( glVertexAttribPointer(attribs_.normal,
+                        attribComponents_(A_NORMAL), attribEnum_(A_NORMAL), attribNormalized_(A_NORMAL),
+                        attribStride_(A_NORMAL), attribOffset_(A_NORMAL)) );
     }
 
     if ((int)attribs_.color>=0)
     {
-        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[2]) );
-        SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, color_.size() * sizeof(ColorType), &color_[0], GL_STATIC_DRAW) );
+        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_COLOR)) );
         SCH_CHECK_GL( glEnableVertexAttribArray(attribs_.color) );
-        SCH_CHECK_GL( glVertexAttribPointer(attribs_.color, 4, ColorEnum, GL_FALSE, 0, NULL) );
+        SCH_CHECK_GL( glVertexAttribPointer(attribs_.color,
+                        attribComponents_(A_COLOR), attribEnum_(A_COLOR), attribNormalized_(A_COLOR),
+                        attribStride_(A_COLOR), attribOffset_(A_COLOR)) );
     }
 
     if ((int)attribs_.texcoord>=0)
     {
-        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[3]) );
-        SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, texcoord_.size() * sizeof(TextureCoordType), &texcoord_[0], GL_STATIC_DRAW) );
+        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, attribBuffer_(A_TEXCOORD)) );
         SCH_CHECK_GL( glEnableVertexAttribArray(attribs_.texcoord) );
-        SCH_CHECK_GL( glVertexAttribPointer(attribs_.texcoord, 2, TextureCoordEnum, GL_FALSE, 0, NULL) );
+        SCH_CHECK_GL( glVertexAttribPointer(attribs_.texcoord,
+                        attribComponents_(A_TEXCOORD), attribEnum_(A_TEXCOORD), attribNormalized_(A_TEXCOORD),
+                        attribStride_(A_TEXCOORD), attribOffset_(A_TEXCOORD)) );
     }
 
+    // attach the index buffer to the vertex array object
+    SCH_CHECK_GL( glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_) );
+
+    // unbind the vao first, so it keeps the element buffer binding
+#ifdef __APPLE__
+    SCH_CHECK_GL( glBindVertexArrayAPPLE(0) );
+#else
+    SCH_CHECK_GL( glBindVertexArray(0) );
+#endif
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+
     isVAO_ = true;
 }
 
+void Model::createBuffers_()
+{
+    if (layout_ == L_INTERLEAVED)
+        createInterleavedBuffer_();
+    else
+        createSeparateBuffers_();
+
+    // indices go to the gpu as well
+    SCH_CHECK_GL( glGenBuffers(1, &indexBuffer_) );
+    SCH_CHECK_GL( glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_) );
+
+    indexEnum_ = indexEnum();
+    numIndices_ = index_.size();
+
+    if (indexEnum_ == GL_UNSIGNED_SHORT)
+    {
+        // narrow to 16 bit
+        std::vector<GLushort> index16(index_.begin(), index_.end());
+        SCH_CHECK_GL( glBufferData(GL_ELEMENT_ARRAY_BUFFER, index16.size() * sizeof(GLushort), index16.data(), GL_STATIC_DRAW) );
+    }
+    else
+        SCH_CHECK_GL( glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_.size() * sizeof(IndexType), index_.data(), GL_STATIC_DRAW) );
+
+    bufferLayout_ = layout_;
+    bufferFormat_ = format_;
+    isBuffer_ = true;
+}
+
+void Model::createSeparateBuffers_()
+{
+    // create buffers for vertex/normal/color/texcoord
+
+    SCH_CHECK_GL( glGenBuffers(4, buffers_) );
+
+    std::vector<unsigned char> data;
+
+    for (int a = A_POSITION; a <= A_TEXCOORD; ++a)
+    {
+        const size_t size = attribSize_((Attribute)a);
+        data.resize(numVertices() * size);
+        packAttribute_((Attribute)a, data.data(), size);
+
+        SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[a]) );
+        SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW) );
+    }
+}
+
+void Model::createInterleavedBuffer_()
+{
+    // one buffer for all attributes, the others stay unused
+    buffers_[1] = buffers_[2] = buffers_[3] = 0;
+    SCH_CHECK_GL( glGenBuffers(1, buffers_) );
+
+    // copy each attribute into it's slot of the vertex struct
+    // [ x y z | nx ny nz | r g b a | u v ]
+    const size_t stride = vertexSize();
+    std::vector<unsigned char> data(numVertices() * stride);
+
+    for (int a = A_POSITION; a <= A_TEXCOORD; ++a)
+        packAttribute_((Attribute)a,
+                       data.data() + (size_t)attribOffset_((Attribute)a), stride);
+
+    SCH_CHECK_GL( glBindBuffer(GL_ARRAY_BUFFER, buffers_[0]) );
+    SCH_CHECK_GL( glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW) );
+}
+
+void Model::packAttribute_(Attribute a, unsigned char * dst, size_t stride) const
+{
+    const size_t nv = numVertices();
+
+    switch (a)
+    {
+        case A_POSITION:
+            for (size_t i=0; i<nv; ++i, dst += stride)
+                memcpy(dst, &vertex_[i*3], 3 * sizeof(VertexType));
+        break;
+
+        case A_NORMAL:
+            if (format_ & F_PACKED_NORMALS)
+            {
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                {
+                    const GLuint p = toSnorm10(normal_[i*3])
+                                   | (toSnorm10(normal_[i*3+1]) << 10)
+                                   | (toSnorm10(normal_[i*3+2]) << 20);
+                    memcpy(dst, &p, sizeof(GLuint));
+                }
+            }
+            else
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                    memcpy(dst, &normal_[i*3], 3 * sizeof(NormalType));
+        break;
+
+        case A_COLOR:
+            if (format_ & F_BYTE_COLORS)
+            {
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                    for (int j=0; j<4; ++j)
+                        dst[j] = toUnorm8(color_[i*4+j]);
+            }
+            else
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                    memcpy(dst, &color_[i*4], 4 * sizeof(ColorType));
+        break;
+
+        case A_TEXCOORD:
+            if (format_ & F_HALF_TEXCOORDS)
+            {
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                {
+                    const GLushort h[2] = { toHalf(texcoord_[i*2]), toHalf(texcoord_[i*2+1]) };
+                    memcpy(dst, h, sizeof(h));
+                }
+            }
+            else
+                for (size_t i=0; i<nv; ++i, dst += stride)
+                    memcpy(dst, &texcoord_[i*2], 2 * sizeof(TextureCoordType));
+        break;
+    }
+}
+
+GLint Model::attribComponents_(Attribute a) const
+{
+    switch (a)
+    {
+        case A_POSITION: return 3;
+        // the packed format always has 4 components
+        case A_NORMAL:   return (format_ & F_PACKED_NORMALS) ? 4 : 3;
+        case A_COLOR:    return 4;
+        case A_TEXCOORD: return 2;
+    }
+    return 0;
+}
+
+GLenum Model::attribEnum_(Attribute a) const
+{
+    switch (a)
+    {
+        case A_POSITION: return VertexEnum;
+        case A_NORMAL:   return (format_ & F_PACKED_NORMALS) ? GL_INT_2_10_10_10_REV : NormalEnum;
+        case A_COLOR:    return (format_ & F_BYTE_COLORS) ? GL_UNSIGNED_BYTE : ColorEnum;
+        case A_TEXCOORD: return (format_ & F_HALF_TEXCOORDS) ? GL_HALF_FLOAT : TextureCoordEnum;
+    }
+    return 0;
+}
+
+GLboolean Model::attribNormalized_(Attribute a) const
+{
+    // integer formats are mapped to [-1,1] or [0,1]
+    return attribEnum_(a) == GL_INT_2_10_10_10_REV
+        || attribEnum_(a) == GL_UNSIGNED_BYTE;
+}
+
+size_t Model::attribSize_(Attribute a) const
+{
+    switch (a)
+    {
+        case A_POSITION: return 3 * sizeof(VertexType);
+        case A_NORMAL:   return (format_ & F_PACKED_NORMALS) ? sizeof(GLuint) : 3 * sizeof(NormalType);
+        case A_COLOR:    return (format_ & F_BYTE_COLORS) ? 4 * sizeof(GLubyte) : 4 * sizeof(ColorType);
+        case A_TEXCOORD: return (format_ & F_HALF_TEXCOORDS) ? 2 * sizeof(GLushort) : 2 * sizeof(TextureCoordType);
+    }
+    return 0;
+}
+
+GLuint Model::attribBuffer_(Attribute a) const
+{
+    return layout_ == L_INTERLEAVED ? buffers_[0] : buffers_[a];
+}
+
+GLsizei Model::attribStride_(Attribute a) const
+{
+    // always give the stride explicitly,
+    // the byte sizes are not nescessarily tightly packed components
+    return layout_ == L_INTERLEAVED ? vertexSize() : attribSize_(a);
+}
+
+const GLvoid * Model::attribOffset_(Attribute a) const
+{
+    if (layout_ != L_INTERLEAVED)
+        return 0;
+
+    size_t offset = 0;
+    for (int i = A_POSITION; i < a; ++i)
+        offset += attribSize_((Attribute)i);
+
+    return (const GLvoid*)offset;
+}
+
 
 #ifdef SCH_USE_QT_OPENGLFUNC
 void Model::initQtOpenGl_()
@@ -55,6 +55,43 @@ public:
     static const GLenum TextureCoordEnum = GL_FLOAT;
     static const GLenum IndexEnum        = GL_UNSIGNED_INT;
 
+    /** Storage formats of the vertex attributes on the GPU.
+        These are flags that can be combined.
+        The CPU-side data is always kept in the types above. */
+    enum Format
+    {
+        /** All attributes as GL_FLOAT */
+        F_FLOAT             = 0,
+        /** Normals packed into GL_INT_2_10_10_10_REV */
+        F_PACKED_NORMALS    = 1,
+        /** Colors as normalized GL_UNSIGNED_BYTE */
+        F_BYTE_COLORS       = 2,
+        /** Texture coordinates as GL_HALF_FLOAT */
+        F_HALF_TEXCOORDS    = 4,
+        /** All of the above */
+        F_COMPACT           = 7
+    };
+
+    /** Weighting of the triangle normals that share a vertex */
+    enum NormalWeighting
+    {
+        /** Each adjacent triangle counts the same */
+        NW_EQUAL,
+        /** Larger triangles count more */
+        NW_AREA,
+        /** Triangles count by their angle at the vertex */
+        NW_ANGLE
+    };
+
+    /** Memory layout of the vertex data on the GPU */
+    enum Layout
+    {
+        /** One buffer per attribute (position, normal, color, texcoord) */
+        L_SEPARATE,
+        /** All attributes interleaved in one buffer (array-of-structs) */
+        L_INTERLEAVED
+    };
+
     // -------- ctor ---------
 
     Model();
@@ -67,11 +104,52 @@ public:
     /** Returns number of triangles in the Model */
     int numTriangles() const { return index_.size() / 3; }
 
+    /** Read access to the vertex positions (3 per vertex) */
+    const VertexType * vertices() const { return &vertex_[0]; }
+    /** Read access to the vertex normals (3 per vertex) */
+    const NormalType * normals() const { return &normal_[0]; }
+    /** Read access to the vertex colors (4 per vertex) */
+    const ColorType * colors() const { return &color_[0]; }
+    /** Read access to the texture coordinates (2 per vertex) */
+    const TextureCoordType * texCoords() const { return &texcoord_[0]; }
+    /** Read access to the triangle indices (3 per triangle) */
+    const IndexType * indices() const { return &index_[0]; }
+
     /** Returns if a vertex array object has been initialized for this model. */
     bool isVAO() const { return isVAO_; }
 
+    /** Returns the vertex buffer layout */
+    Layout layout() const { return layout_; }
+
+    /** Returns the storage format flags of the vertex buffer(s) */
+    int format() const { return format_; }
+
+    /** Returns the number of bytes per vertex in the vertex buffer(s) */
+    size_t vertexSize() const;
+
+    /** Returns the type of the indices in the element buffer.
+        Indices are narrowed to GL_UNSIGNED_SHORT for less than 65536 vertices. */
+    GLenum indexEnum() const;
+
+    /** Returns the number of bytes per index in the element buffer */
+    size_t indexSize() const;
+
+    /** Returns the number of bytes needed on the GPU for the current format */
+    size_t memoryGPU() const;
+
+    /** Returns the number of bytes used by the CPU-side data */
+    size_t memoryCPU() const;
+
     // --------- state -----------------------
 
+    /** Sets the layout of the vertex buffer(s).
+        Takes effect on the next call to setShaderLocations(). */
+    void setLayout(Layout layout) { layout_ = layout; }
+
+    /** Sets the storage format of the vertex buffer(s), as combination of Format flags.
+        Takes effect on the next call to setShaderLocations(). */
+    void setFormat(int format) { format_ = format; }
+
     /** Sets the current color. Any subsequent call to the
         easy form of addVertex() will use this color. */
     void setColor(ColorType r, ColorType g, ColorType b, ColorType a)
@@ -106,15 +184,96 @@ public:
     /** Connects three previously created indices to form a triangle. */
     void addTriangle(IndexType p1, IndexType p2, IndexType p3);
 
+    // -------- bulk vertex/triangle handling -----
+
+    /** Pointers into the Model's storage for direct writes.
+        @see appendVertices() */
+    struct VertexSpan
+    {
+        /** Index of the first vertex of the span */
+        IndexType first;
+        /** Number of vertices in the span */
+        size_t num;
+        /** 3 per vertex */
+        VertexType * position;
+        /** 3 per vertex */
+        NormalType * normal;
+        /** 4 per vertex */
+        ColorType * color;
+        /** 2 per vertex */
+        TextureCoordType * texcoord;
+    };
+
+    /** Reserves memory for the given total number of vertices and triangles.
+        Subsequent adds up to these numbers will not reallocate. */
+    void reserve(size_t numVertices, size_t numTriangles);
+
+    /** Appends @p num vertices and returns pointers to their storage.
+        Positions are zero, the other attributes are set to the current
+        normal, color and texture coordinate.
+        @note The pointers are only valid until the next vertex is added. */
+    VertexSpan appendVertices(size_t num);
+
+    /** Appends @p num triangles and returns a pointer to their 3 * num
+        indices, which are uninitialized and must all be written.
+        @note The pointer is only valid until the next triangle is added. */
+    IndexType * appendTriangles(size_t num);
+
+    /** Appends @p num vertices from arrays of positions (3 per vertex),
+        normals (3), colors (4) and texture coordinates (2).
+        Any array but @p position can be NULL, in which case the current
+        normal, color or texture coordinate is used.
+        @returns the index of the first new vertex. */
+    IndexType addVertices(size_t num, const VertexType * position,
+                          const NormalType * normal = 0,
+                          const ColorType * color = 0,
+                          const TextureCoordType * texcoord = 0);
+
+    /** Appends @p num triangles from an array of 3 * num indices.
+        @p offset is added to each index, so indices relative to
+        the result of addVertices() can be used. */
+    void addTriangles(size_t num, const IndexType * indices, IndexType offset = 0);
+
     // ------- convenience functions -------
 
     /** Automatically calculates all normals for each triangle.
-        Normals that share multiple triangles will be averaged. */
-    void calculateTriangleNormals();
+        Normals that share multiple triangles will be averaged
+        according to @p weighting and renormalized.
+        With @p multiThreaded, the work is distributed over all cores. */
+    void calculateTriangleNormals(NormalWeighting weighting = NW_EQUAL,
+                                  bool multiThreaded = true);
 
     /** Makes every vertex in the model unique.
-        After this call, every triangle will have it's unique vertices. */
-    void unGroupVertices();
+        After this call, every triangle will have it's unique vertices
+        and the normals are set to the triangle normals.
+        With @p multiThreaded, the triangles are distributed over all cores. */
+    void unGroupVertices(bool multiThreaded = true);
+
+    /** Merges vertices whose attributes (position, normal, color and
+        texture coordinate) all differ by no more than @p epsilon.
+        Runs in about linear time through a hash grid on the positions.
+        Triangles that collapse to a line or point are removed.
+        @note unGroupVertices() assigns each triangle it's own normal,
+        so after that, only corners of coplanar triangles can be merged
+        with their neighbours. Triangle soup with shared normals welds
+        back to a fully indexed mesh.
+        @returns the number of removed vertices. */
+    int weldVertices(float epsilon = 0.f);
+
+    // ------- optimization ----------------
+
+    /** Returns the average cache miss ratio, e.g. the number of vertex
+        shader invocations per triangle, for a FIFO post-transform
+        vertex cache of @p cacheSize entries.
+        Ranges from about 0.5 (best) to 3.0 (worst). */
+    float acmr(int cacheSize = 16) const;
+
+    /** Reorders the triangles for post-transform vertex cache locality,
+        using the Tipsify algorithm [Sander, Nehab, Barczak 2007],
+        and then reorders the vertices in the order of their first use,
+        for vertex fetch locality.
+        The geometry itself is not changed. Compare acmr() before and after. */
+    void optimizeIndices(int cacheSize = 16);
 
     // ------------- opengl / drawing ---------------
 
@@ -126,23 +285,72 @@ public:
     void releaseGL();
 
     /** Transmits the vertex attribute locations from the shader.
-        This needs to be called for Model to create it's vertex array object */
+        This needs to be called for Model to create it's vertex array object.
+        The buffers are uploaded only once, the vertex array object is
+        only rebuilt if the locations differ from the previous call. */
     void setShaderLocations(const ShaderLocations&);
 
     /** Draws the vertex array object.
+        The indices are read from an element buffer on the gpu.
         @note This needs a shader working with the vertex attributes. */
     void draw();
 
-    /** Draws the model through oldschool opengl arrays */
+    /** Draws the model through oldschool opengl arrays.
+        The data is uploaded to buffers on first use. */
     void drawOldschool();
 
     /** @} */
 
 private:
 
-    /** Creates the vertexArrayObject from the initialized data. */
+    /** Returns the acmr() of the given index list */
+    float acmr_(const std::vector<IndexType>& index, int cacheSize) const;
+
+    /** Index into buffers_ for the separate layout */
+    enum Attribute
+    {
+        A_POSITION,
+        A_NORMAL,
+        A_COLOR,
+        A_TEXCOORD
+    };
+
+    /** Creates the vertexArrayObject from the initialized data.
+        The buffers are only uploaded if not already present. */
     void createVAO_();
 
+    /** Deletes the vertexArrayObject but keeps the buffers */
+    void releaseVAO_();
+
+    /** Uploads the vertex and index data to the gpu. */
+    void createBuffers_();
+
+    /** Creates one buffer per attribute */
+    void createSeparateBuffers_();
+
+    /** Creates one buffer with all attributes interleaved */
+    void createInterleavedBuffer_();
+
+    /** Converts the attribute of each vertex to the storage format
+        and writes it to @p dst, advancing by @p stride bytes per vertex. */
+    void packAttribute_(Attribute, unsigned char * dst, size_t stride) const;
+
+    /** Returns the number of components of the attribute for gl*Pointer() */
+    GLint attribComponents_(Attribute) const;
+    /** Returns the storage type of the attribute */
+    GLenum attribEnum_(Attribute) const;
+    /** Returns the size of the attribute in bytes */
+    size_t attribSize_(Attribute) const;
+
+    /** Returns the buffer that holds the attribute */
+    GLuint attribBuffer_(Attribute) const;
+    /** Returns if the integer attribute is normalized to floats */
+    GLboolean attribNormalized_(Attribute) const;
+    /** Returns the stride of the attribute in it's buffer */
+    GLsizei attribStride_(Attribute) const;
+    /** Returns the offset of the attribute in it's buffer */
+    const GLvoid * attribOffset_(Attribute) const;
+
 #ifdef SCH_USE_QT_OPENGLFUNC
     void initQtOpenGl_();
 #endif
@@ -162,9 +370,18 @@ private:
 
     ShaderLocations attribs_;
 
-    /** vertex array object */
-    GLuint buffers_[4], vao_;
-    bool isVAO_;
+    Layout layout_;
+    int format_;
+
+    /** vertex buffers, element buffer and vertex array object */
+    GLuint buffers_[4], indexBuffer_, vao_;
+    /** number and type of indices in the element buffer */
+    GLsizei numIndices_;
+    GLenum indexEnum_;
+    /** layout and format of the uploaded buffers */
+    Layout bufferLayout_;
+    int bufferFormat_;
+    bool isVAO_, isBuffer_;
 
 #ifdef SCH_USE_QT_OPENGLFUNC
     bool isGlFuncInitialized_;
@@ -0,0 +1,395 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <vector>
+#include <algorithm>
+
+#include <QElapsedTimer>
+
+#include "modelbenchmark.h"
+#include "modelfactory.h"
+#include "model.h"
+#include "glsl.h"
+#include "parallel.h"
+#include "debug.h"
+#include "vector.h"
+
+namespace {
+
+    /** The serial vertex normal loop of the original
+        Model::calculateTriangleNormals(), as the baseline to compare to.
+        Model has no writable normals, so they go to @p normal. */
+    void baselineNormals(const Model& m, std::vector<Model::NormalType>& normal)
+    {
+        const Model::VertexType * vertex = m.vertices();
+        const Model::IndexType * index = m.indices();
+
+        normal.assign(m.numVertices() * 3, 0);
+        std::vector<size_t> nr_adds(m.numVertices());
+
+        for (int i=0; i<m.numTriangles(); ++i)
+        {
+            const size_t
+                v1 = index[i*3],
+                v2 = index[i*3+1],
+                v3 = index[i*3+2];
+            const Vec3
+                p1 = Vec3(vertex[v1*3], vertex[v1*3+1], vertex[v1*3+2]),
+                p2 = Vec3(vertex[v2*3], vertex[v2*3+1], vertex[v2*3+2]),
+                p3 = Vec3(vertex[v3*3], vertex[v3*3+1], vertex[v3*3+2]);
+
+            const Vec3 n = glm::normalize( glm::cross( p2-p1, p3-p1 ) );
+
+            normal[v1*3  ] += n[0];
+            normal[v1*3+1] += n[1];
+            normal[v1*3+2] += n[2];
+            normal[v2*3  ] += n[0];
+            normal[v2*3+1] += n[1];
+            normal[v2*3+2] += n[2];
+            normal[v3*3  ] += n[0];
+            normal[v3*3+1] += n[1];
+            normal[v3*3+2] += n[2];
+
+            nr_adds[v1]++;
+            nr_adds[v2]++;
+            nr_adds[v3]++;
+        }
+
+        for (size_t i=0; i<normal.size(); ++i)
+            if (nr_adds[i/3])
+                normal[i] /= nr_adds[i/3];
+    }
+
+} // namespace
+
+ModelBenchmark::ModelBenchmark()
+    :   numDraws_   (100)
+{
+}
+
+QString ModelBenchmark::run(Test test, const ShaderLocations& loc)
+{
+    switch (test)
+    {
+        case T_LAYOUTS: return compareLayouts(loc);
+        case T_FORMATS: return compareFormats(loc);
+        case T_UNGROUP: return compareUnGroup();
+        case T_GRID: return compareGrid();
+        case T_FROZEN: break;
+    }
+    return QString();
+}
+
+QString ModelBenchmark::compareLayouts(const ShaderLocations& loc)
+{
+    ModelFactory f;
+    QString text = "vertex layout benchmark\n";
+
+    Model * m = f.createTeapot(1.f);
+    text += compareLayouts_("teapot", m, loc);
+    delete m;
+
+    m = f.createUVSphere(5.f, 1024, 512);
+    text += compareLayouts_("uv-sphere 1024x512", m, loc);
+    delete m;
+
+    return text;
+}
+
+QString ModelBenchmark::compareFormats(const ShaderLocations& loc)
+{
+    ModelFactory f;
+    QString text = "vertex format benchmark\n";
+
+    Model * m = f.createTeapot(1.f);
+    text += compareFormats_("teapot", m, loc);
+    delete m;
+
+    m = f.createUVSphere(5.f, 1024, 512);
+    text += compareFormats_("uv-sphere 1024x512", m, loc);
+    delete m;
+
+    return text;
+}
+
+QString ModelBenchmark::compareUnGroup()
+{
+    ModelFactory f;
+    QElapsedTimer timer;
+
+    Model * src = f.createUVSphere(5.f, 1000, 501);
+    QString text = QString("ungroup benchmark\nuv-sphere 1000x501: %1 vertices, %2 triangles\n")
+            .arg(src->numVertices()).arg(src->numTriangles());
+
+    // vertex-by-vertex through the public interface,
+    // with the serial normal loop it replaced
+    timer.start();
+    {
+        std::vector<Model::NormalType> normal;
+        Model m;
+        const Model::VertexType * v = src->vertices();
+        const Model::NormalType * n = src->normals();
+        const Model::ColorType * c = src->colors();
+        const Model::TextureCoordType * t = src->texCoords();
+        const Model::IndexType * idx = src->indices();
+        for (int i=0; i<src->numTriangles() * 3; i += 3)
+        {
+            Model::IndexType tri[3];
+            for (int k=0; k<3; ++k)
+            {
+                const Model::IndexType j = idx[i+k];
+                tri[k] = m.addVertex(v[j*3], v[j*3+1], v[j*3+2],
+                                     n[j*3], n[j*3+1], n[j*3+2],
+                                     c[j*4], c[j*4+1], c[j*4+2], c[j*4+3],
+                                     t[j*2], t[j*2+1]);
+            }
+            m.addTriangle(tri[0], tri[1], tri[2]);
+        }
+        baselineNormals(m, normal);
+    }
+    const double naive_ms = timer.nsecsElapsed() / 1000000.;
+
+    // the real thing
+    double ms[2];
+    for (int mt=0; mt<2; ++mt)
+    {
+        Model m(*src);
+        timer.start();
+        m.unGroupVertices(mt != 0);
+        ms[mt] = timer.nsecsElapsed() / 1000000.;
+    }
+
+    delete src;
+
+    text += QString("  addVertex()                    %1 ms\n"
+                    "  unGroupVertices()              %2 ms  (x%3)\n"
+                    "  unGroupVertices() %4 threads   %5 ms  (x%6)\n")
+            .arg(naive_ms, 0, 'f', 1)
+            .arg(ms[0], 0, 'f', 1).arg(naive_ms / std::max(0.001, ms[0]), 0, 'f', 1)
+            .arg(numParallelThreads(), 2)
+            .arg(ms[1], 0, 'f', 1).arg(naive_ms / std::max(0.001, ms[1]), 0, 'f', 1);
+
+    return text;
+}
+
+QString ModelBenchmark::compareGrid()
+{
+    const unsigned int seg = 2000, rowlen = seg + 1;
+    QElapsedTimer timer;
+
+    // vertex-by-vertex
+    timer.start();
+    int numv, numt;
+    {
+        Model m;
+        m.setNormal(0, 1, 0);
+        for (unsigned int v = 0; v <= seg; ++v)
+        for (unsigned int u = 0; u <= seg; ++u)
+        {
+            m.setTexCoord((float)u / seg, 1.f - (float)v / seg);
+            m.addVertex(((float)u / seg - 0.5f) * 10.f, 0.f,
+                        ((float)v / seg - 0.5f) * 10.f);
+        }
+        for (unsigned int v = 0; v < seg; ++v)
+        for (unsigned int u = 0; u < seg; ++u)
+        {
+            const Model::IndexType a = v * rowlen + u;
+            m.addTriangle(a, a + rowlen, a + 1);
+            m.addTriangle(a + 1, a + rowlen, a + rowlen + 1);
+        }
+        numv = m.numVertices();
+        numt = m.numTriangles();
+    }
+    const double naive_ms = timer.nsecsElapsed() / 1000000.;
+
+    // bulk
+    ModelFactory f;
+    timer.start();
+    Model * m = f.createGrid(10.f, 10.f, seg, seg);
+    const double bulk_ms = timer.nsecsElapsed() / 1000000.;
+    delete m;
+
+    return QString("grid benchmark\n%1x%1 grid: %2 vertices, %3 triangles\n"
+                   "  addVertex()/addTriangle()      %4 ms\n"
+                   "  ModelFactory::createGrid()     %5 ms  (x%6)\n")
+            .arg(seg).arg(numv).arg(numt)
+            .arg(naive_ms, 0, 'f', 1)
+            .arg(bulk_ms, 0, 'f', 1).arg(naive_ms / std::max(0.001, bulk_ms), 0, 'f', 1);
+}
+
+void ModelBenchmark::measure_(Model * m, const ShaderLocations& loc,
+                              double& upload_ms, double& draw_ms)
+{
+    QElapsedTimer timer;
+
+    // upload the buffers
+    SCH_CHECK_GL( glFinish() );
+    timer.start();
+    m->setShaderLocations(loc);
+    SCH_CHECK_GL( glFinish() );
+    upload_ms = timer.nsecsElapsed() / 1000000.;
+
+    // one draw to wake up the driver
+    m->draw();
+    SCH_CHECK_GL( glFinish() );
+
+    // throughput
+    timer.start();
+    for (int i=0; i<numDraws_; ++i)
+        m->draw();
+    SCH_CHECK_GL( glFinish() );
+    draw_ms = timer.nsecsElapsed() / 1000000. / std::max(1, numDraws_);
+
+    m->releaseGL();
+}
+
+double ModelBenchmark::measureShader_(Glsl * shader, Model * m,
+                                      const std::function<void()>& sendUniforms)
+{
+    if (!shader->compile())
+        return -1.;
+
+    shader->activate();
+    shader->sendUniforms();
+    sendUniforms();
+
+    // attribute locations are fixed, so the vao stays valid
+    m->setShaderLocations(shader->getShaderLocations());
+
+    // one draw to wake up the driver
+    m->draw();
+    SCH_CHECK_GL( glFinish() );
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i=0; i<numDraws_; ++i)
+        m->draw();
+    SCH_CHECK_GL( glFinish() );
+
+    return timer.nsecsElapsed() / 1000000. / std::max(1, numDraws_);
+}
+
+QString ModelBenchmark::compareFrozen(Glsl * shader, Model * m,
+                                      const std::function<void()>& sendUniforms)
+{
+    QString text = "frozen uniforms benchmark\n";
+    if (!shader || !m)
+        return text + "  needs a shader and a model\n";
+    // the blocking compiles below would cancel it
+    if (shader->isCompiling())
+        return text + "  the shader is compiling, try again when it is done\n";
+
+    text += QString("  %1 vertices, %2 triangles, %3 draws\n")
+            .arg(m->numVertices()).arg(m->numTriangles()).arg(numDraws_);
+
+    const bool wasFrozen = shader->uniformsFrozen();
+
+    // (the second compile of each is usually taken from the
+    //  linked program cache)
+    shader->unfreezeUniforms();
+    const double dynamic_ms = measureShader_(shader, m, sendUniforms);
+
+    shader->freezeUniforms();
+    const double frozen_ms = measureShader_(shader, m, sendUniforms);
+
+    if (!wasFrozen)
+    {
+        shader->unfreezeUniforms();
+        shader->compile();
+    }
+
+    if (dynamic_ms < 0. || frozen_ms < 0.)
+        return text + "  compile error\n" + shader->log();
+
+    text += QString("  dynamic  draw %1 ms\n"
+                    "  frozen   draw %2 ms  (%3%)\n")
+            .arg(dynamic_ms, 0, 'f', 3)
+            .arg(frozen_ms, 0, 'f', 3)
+            .arg(dynamic_ms > 0. ? 100. * frozen_ms / dynamic_ms : 0., 0, 'f', 1);
+
+    return text;
+}
+
+QString ModelBenchmark::compareLayouts_(const QString& name, Model * m,
+                                        const ShaderLocations& loc)
+{
+    QString text = QString("%1: %2 vertices, %3 triangles\n")
+            .arg(name).arg(m->numVertices()).arg(m->numTriangles());
+
+    const Model::Layout layouts[] = { Model::L_SEPARATE, Model::L_INTERLEAVED };
+    const char * names[] = { "separate   ", "interleaved" };
+
+    for (int l=0; l<2; ++l)
+    {
+        m->setLayout(layouts[l]);
+
+        double upload_ms, draw_ms;
+        measure_(m, loc, upload_ms, draw_ms);
+
+        const double mtris = draw_ms > 0. ? m->numTriangles() / draw_ms / 1000. : 0.;
+
+        text += QString("  %1  upload %2 ms  draw %3 ms  (%4 Mtris/s)\n")
+                .arg(names[l])
+                .arg(upload_ms, 0, 'f', 3)
+                .arg(draw_ms, 0, 'f', 3)
+                .arg(mtris, 0, 'f', 1);
+    }
+
+    return text;
+}
+
+QString ModelBenchmark::compareFormats_(const QString& name, Model * m,
+                                        const ShaderLocations& loc)
+{
+    QString text = QString("%1: %2 vertices, %3 triangles, %4 KB on cpu, %5 indices\n")
+            .arg(name).arg(m->numVertices()).arg(m->numTriangles())
+            .arg(m->memoryCPU() / 1024)
+            .arg(m->indexEnum() == GL_UNSIGNED_SHORT ? "16 bit" : "32 bit");
+
+    const int formats[] = { Model::F_FLOAT,
+                            Model::F_PACKED_NORMALS,
+                            Model::F_BYTE_COLORS,
+                            Model::F_HALF_TEXCOORDS,
+                            Model::F_COMPACT };
+    const char * names[] = { "float         ",
+                             "packed normals",
+                             "byte colors   ",
+                             "half texcoords",
+                             "compact       " };
+
+    m->setLayout(Model::L_INTERLEAVED);
+
+    for (int f=0; f<5; ++f)
+    {
+        m->setFormat(formats[f]);
+
+        double upload_ms, draw_ms;
+        measure_(m, loc, upload_ms, draw_ms);
+
+        text += QString("  %1  %2 bytes/vertex  %3 KB on gpu  upload %4 ms  draw %5 ms\n")
+                .arg(names[f])
+                .arg(m->vertexSize(), 2)
+                .arg(m->memoryGPU() / 1024)
+                .arg(upload_ms, 0, 'f', 3)
+                .arg(draw_ms, 0, 'f', 3);
+    }
+
+    return text;
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef MODELBENCHMARK_H
+#define MODELBENCHMARK_H
+
+#include <functional>
+
+#include <QString>
+
+#include "opengl.h"
+
+// forwards
+class Model;
+class Glsl;
+
+/** @brief Measures the performance of different Model setups.
+
+    The results are returned as readable text, suitable for the log view.
+*/
+class ModelBenchmark
+{
+public:
+    /** Available tests */
+    enum Test
+    {
+        T_LAYOUTS,
+        T_FORMATS,
+        T_UNGROUP,
+        T_GRID,
+        T_FROZEN
+    };
+
+    ModelBenchmark();
+
+    /** Sets the number of draw calls for each throughput measurement */
+    void setNumDraws(int num) { numDraws_ = num; }
+
+    /** Compares upload time and draw throughput of the
+        separate and interleaved vertex layouts,
+        using the teapot and a dense uv-sphere.
+        @note Needs an opengl context and an activated shader
+        whose attribute locations are given in @p locations. */
+    QString compareLayouts(const ShaderLocations& locations);
+
+    /** Compares memory usage and draw throughput of the
+        vertex storage formats (see Model::Format),
+        using the teapot and a dense uv-sphere.
+        @note Needs an opengl context and an activated shader
+        whose attribute locations are given in @p locations. */
+    QString compareFormats(const ShaderLocations& locations);
+
+    /** Compares the speed of Model::unGroupVertices(), single- and
+        multi-threaded, with a vertex-by-vertex rebuild through
+        Model::addVertex() on a mesh with about 1M triangles.
+        Does not need an opengl context. */
+    QString compareUnGroup();
+
+    /** Compares building a grid with 4M vertices vertex-by-vertex
+        through Model::addVertex() with ModelFactory::createGrid(),
+        which writes into pre-sized storage.
+        Does not need an opengl context. */
+    QString compareGrid();
+
+    /** Compares the draw time of the shader with dynamic uniforms
+        and with the uniforms frozen into constants (see Glsl::freezeUniforms()),
+        drawing @p model numDraws_ times.
+        @p sendUniforms is called after activating each program and
+        should send the renderer specific uniforms.
+        The shader is left in it's previous freeze state.
+        Refuses to run while the shader is compiling.
+        @note Needs an opengl context. */
+    QString compareFrozen(Glsl * shader, Model * model,
+                          const std::function<void()>& sendUniforms);
+
+    /** Runs one of the tests from the Test enum.
+        T_FROZEN is not handled here, see compareFrozen(). */
+    QString run(Test test, const ShaderLocations& locations);
+
+private:
+
+    /** Runs the layout comparison for one model */
+    QString compareLayouts_(const QString& name, Model * model,
+                            const ShaderLocations& locations);
+
+    /** Runs the format comparison for one model */
+    QString compareFormats_(const QString& name, Model * model,
+                            const ShaderLocations& locations);
+
+    /** Uploads the model and draws it numDraws_ times.
+        Returns the upload time and the time per draw in milliseconds. */
+    void measure_(Model * model, const ShaderLocations& locations,
+                  double& upload_ms, double& draw_ms);
+
+    /** Compiles and activates the shader and draws the model numDraws_ times.
+        Returns the time per draw in milliseconds or -1 on compile errors. */
+    double measureShader_(Glsl * shader, Model * model,
+                          const std::function<void()>& sendUniforms);
+
+    int numDraws_;
+};
+
+#endif // MODELBENCHMARK_H
@@ -0,0 +1,204 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <QRunnable>
+#include <QMetaObject>
+#include <QMutexLocker>
+
+#include "modelbuilder.h"
+#include "modelfactory.h"
+
+
+/** The work package that runs on the thread pool */
+class ModelBuilder::Job : public QRunnable
+{
+public:
+    Job(ModelBuilder * builder, int id, const Settings& set,
+        std::shared_ptr<std::atomic<bool>> cancel)
+        :   builder_(builder), id_(id), set_(set), cancel_(cancel)
+    { }
+
+    void run()
+    {
+        QString info;
+        Model * m = build_(info);
+        if (m && cancelled_())
+        {
+            delete m;
+            m = 0;
+        }
+        // ModelBuilder waits for the pool on destruction,
+        // so the builder is still alive here, but the queued call
+        // might never be delivered, so the builder keeps track of the model
+        if (m)
+        {
+            QMutexLocker lock(&builder_->resultMutex_);
+            builder_->results_.insert(m);
+        }
+        QMetaObject::invokeMethod(builder_, "onFinished_", Qt::QueuedConnection,
+                                  Q_ARG(int, id_), Q_ARG(Model*, m), Q_ARG(QString, info));
+    }
+
+private:
+
+    bool cancelled_() const { return *cancel_; }
+
+    void progress_(int percent)
+    {
+        QMetaObject::invokeMethod(builder_, "onProgress_", Qt::QueuedConnection,
+                                  Q_ARG(int, id_), Q_ARG(int, percent));
+    }
+
+    Model * build_(QString& info)
+    {
+        // --- create ---
+
+        ModelFactory f;
+        // generation is the first 70%
+        int lastPercent = -1;
+        f.setProgressFunction([this, &lastPercent](float p)
+        {
+            const int percent = p * 70;
+            if (percent != lastPercent)
+                progress_(lastPercent = percent);
+            return !cancelled_();
+        });
+
+        Model * m;
+        switch (set_.shape)
+        {
+            case Settings::S_BOX:    m = f.createCube(set_.scale); break;
+            case Settings::S_SPHERE: m = f.createUVSphere(set_.scale, 20, 20); break;
+            case Settings::S_GRID:   m = f.createGrid(set_.scale*2, set_.scale*2, 100, 100); break;
+            default:                 m = f.createTeapot(set_.scale/5); break;
+        }
+        if (!m || cancelled_())
+        {
+            delete m;
+            return 0;
+        }
+        progress_(70);
+
+        // --- post-process ---
+
+        if (!set_.groupVertices)
+            m->unGroupVertices();
+
+        int welded = 0;
+        if (set_.weldVertices)
+            welded = m->weldVertices(1e-5f);
+
+        if (cancelled_())
+        {
+            delete m;
+            return 0;
+        }
+        progress_(85);
+
+        if (set_.optimizeIndices)
+        {
+            const float acmr = m->acmr();
+            m->optimizeIndices();
+            info = QString("average cache miss ratio %1 -> %2")
+                    .arg(acmr, 0, 'f', 3).arg(m->acmr(), 0, 'f', 3);
+        }
+        else
+            info = QString("%1 vertices, %2 triangles")
+                    .arg(m->numVertices()).arg(m->numTriangles());
+
+        if (set_.weldVertices)
+            info += QString(", %1 vertices welded").arg(welded);
+
+        m->setLayout(set_.layout);
+        m->setFormat(set_.format);
+
+        progress_(100);
+        return m;
+    }
+
+    ModelBuilder * builder_;
+    int id_;
+    Settings set_;
+    std::shared_ptr<std::atomic<bool>> cancel_;
+};
+
+
+
+ModelBuilder::ModelBuilder(QObject * parent)
+    :   QObject (parent),
+        curId_  (0),
+        busy_   (false)
+{
+    qRegisterMetaType<Model*>("Model*");
+}
+
+ModelBuilder::~ModelBuilder()
+{
+    cancel();
+    pool_.waitForDone();
+
+    // queued calls to onFinished_() are dropped with this object
+    for (auto m : results_)
+        delete m;
+}
+
+void ModelBuilder::build(const Settings& set)
+{
+    cancel();
+
+    cancel_ = std::make_shared<std::atomic<bool>>(false);
+    busy_ = true;
+
+    // the pool deletes the job when done
+    pool_.start(new Job(this, ++curId_, set, cancel_));
+}
+
+void ModelBuilder::cancel()
+{
+    if (cancel_)
+        *cancel_ = true;
+    busy_ = false;
+}
+
+void ModelBuilder::onProgress_(int id, int percent)
+{
+    if (id == curId_ && busy_)
+        emit progress(percent);
+}
+
+void ModelBuilder::onFinished_(int id, Model * m, const QString& info)
+{
+    {
+        QMutexLocker lock(&resultMutex_);
+        results_.remove(m);
+    }
+
+    // discard results of outdated builds
+    if (id != curId_ || !busy_)
+    {
+        delete m;
+        return;
+    }
+
+    busy_ = false;
+
+    if (m)
+        emit finished(m, info);
+}
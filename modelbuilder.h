@@ -0,0 +1,132 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef MODELBUILDER_H
+#define MODELBUILDER_H
+
+#include <atomic>
+#include <memory>
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSet>
+
+#include "model.h"
+
+// for the queued connection from the worker
+Q_DECLARE_METATYPE(Model*)
+
+/** @brief Creates Models on a worker thread.
+
+    The model is built with the ModelFactory and post-processed
+    according to the Settings, completely off the gui thread.
+    The finished CPU-side Model is handed over through finished().
+    Starting a new build cancels the previous one.
+*/
+class ModelBuilder : public QObject
+{
+    Q_OBJECT
+public:
+
+    /** Everything that describes the model to build */
+    struct Settings
+    {
+        enum Shape
+        {
+            S_BOX,
+            S_SPHERE,
+            S_TEAPOT,
+            S_GRID
+        };
+
+        Shape shape;
+        float scale;
+        bool groupVertices,
+             weldVertices,
+             optimizeIndices;
+        Model::Layout layout;
+        int format;
+
+        Settings()
+            :   shape           (S_TEAPOT),
+                scale           (5.f),
+                groupVertices   (true),
+                weldVertices    (false),
+                optimizeIndices (false),
+                layout          (Model::L_SEPARATE),
+                format          (Model::F_FLOAT)
+        { }
+    };
+
+    explicit ModelBuilder(QObject * parent = 0);
+
+    /** Cancels any running build and waits for the worker to finish */
+    ~ModelBuilder();
+
+    /** Returns true while a model is being built */
+    bool isBusy() const { return busy_; }
+
+signals:
+
+    /** Progress of the current build in percent */
+    void progress(int percent);
+
+    /** Emitted when a model is ready.
+        Ownership of the model is passed to the receiver!
+        @p info contains some readable information about the build. */
+    void finished(Model * model, const QString& info);
+
+public slots:
+
+    /** Starts building a model with the given settings.
+        A running build is cancelled. */
+    void build(const ModelBuilder::Settings& settings);
+
+    /** Cancels the current build, if any */
+    void cancel();
+
+private slots:
+
+    // called from the worker thread through queued connections
+
+    void onProgress_(int id, int percent);
+    void onFinished_(int id, Model * model, const QString& info);
+
+private:
+
+    class Job;
+
+    QThreadPool pool_;
+
+    /** id of the current build, results of older builds are discarded */
+    int curId_;
+    bool busy_;
+
+    /** cancel flag of the current build */
+    std::shared_ptr<std::atomic<bool>> cancel_;
+
+    /** finished models that are not yet delivered to onFinished_(),
+        deleted on destruction */
+    QMutex resultMutex_;
+    QSet<Model*> results_;
+};
+
+#endif // MODELBUILDER_H
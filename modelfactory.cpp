@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include "model.h"
 #include "vector.h"
 #include "teapot_data.h"
+#include "parallel.h"
 
 ModelFactory::ModelFactory()
 {
@@ -105,12 +106,21 @@ Model * ModelFactory::createUVSphere(float rad, unsigned int segu, unsigned int
 {
     Model * m = new Model;
 
+    // reserve the exact size
+    m->reserve(2 + (segv - 1) * segu, segu * 2 + (segv - 2) * segu * 2);
+
     // top point
     m->setTexCoord(0,1);
     m->addVertex(0, rad, 0);
 
     for (unsigned int v = 1; v<segv; ++v)
     {
+        if (!progress_((float)v / segv))
+        {
+            delete m;
+            return 0;
+        }
+
         // current vertex offset
         int rown = m->numVertices();
 
@@ -175,27 +185,93 @@ Model * ModelFactory::createTeapot(float scale)
         maxy = std::max(maxy, TeapotNS::vertices[i][1]);
 
     // create vertices
+    Model::VertexSpan v = m->appendVertices(TeapotNS::numVertices);
     for (int i=0; i<TeapotNS::numVertices; ++i)
     {
         // calculate 'some' texture coordinates for the teapot
         float ang = atan2(TeapotNS::vertices[i][0], TeapotNS::vertices[i][2]);
-        m->setTexCoord(ang / TWO_PI + 0.5f, TeapotNS::vertices[i][1] / maxy);
+        v.texcoord[i*2  ] = ang / TWO_PI + 0.5f;
+        v.texcoord[i*2+1] = TeapotNS::vertices[i][1] / maxy;
 
         // just copy the data
-        m->addVertex(TeapotNS::vertices[i][0] * scale,
-                     TeapotNS::vertices[i][1] * scale,
-                     TeapotNS::vertices[i][2] * scale);
+        v.position[i*3  ] = TeapotNS::vertices[i][0] * scale;
+        v.position[i*3+1] = TeapotNS::vertices[i][1] * scale;
+        v.position[i*3+2] = TeapotNS::vertices[i][2] * scale;
     }
 
     // create triangles
+    Model::IndexType * idx = m->appendTriangles(TeapotNS::numFaces);
     for (int i=0; i<TeapotNS::numFaces; ++i)
     {
-        m->addTriangle(TeapotNS::faces[i][1],
-                       TeapotNS::faces[i][2],
-                       TeapotNS::faces[i][3]);
+        idx[i*3  ] = TeapotNS::faces[i][1];
+        idx[i*3+1] = TeapotNS::faces[i][2];
+        idx[i*3+2] = TeapotNS::faces[i][3];
     }
 
     m->calculateTriangleNormals();
 
     return m;
 }
+
+
+Model * ModelFactory::createGrid(float sidelength_x, float sidelength_z,
+                                 unsigned int segu, unsigned int segv) const
+{
+    Model * m = new Model;
+
+    segu = std::max(1u, segu);
+    segv = std::max(1u, segv);
+
+    const unsigned int
+        rowlen = segu + 1,
+        numv = rowlen * (segv + 1);
+
+    // facing up
+    m->setNormal(0, 1, 0);
+
+    // write all vertices directly into the model
+    Model::VertexSpan s = m->appendVertices(numv);
+    parallelFor(segv + 1, [=](size_t begin, size_t end)
+    {
+        for (size_t v = begin; v < end; ++v)
+        {
+            const float tv = (float)v / segv;
+            for (unsigned int u = 0; u < rowlen; ++u)
+            {
+                const float tu = (float)u / segu;
+                const size_t i = v * rowlen + u;
+                s.position[i*3  ] = (tu - 0.5f) * sidelength_x;
+                s.position[i*3+1] = 0.f;
+                s.position[i*3+2] = (tv - 0.5f) * sidelength_z;
+                s.texcoord[i*2  ] = tu;
+                s.texcoord[i*2+1] = 1.f - tv;
+            }
+        }
+    }, 64);
+
+    if (!progress_(0.5f))
+    {
+        delete m;
+        return 0;
+    }
+
+    // two triangles per quad
+    Model::IndexType * idx = m->appendTriangles(segu * segv * 2);
+    parallelFor(segv, [=](size_t begin, size_t end)
+    {
+        for (size_t v = begin; v < end; ++v)
+        for (unsigned int u = 0; u < segu; ++u)
+        {
+            const Model::IndexType
+                a = v * rowlen + u,
+                b = a + 1,
+                c = a + rowlen,
+                d = c + 1;
+            Model::IndexType * t = &idx[(v * segu + u) * 6];
+            t[0] = a; t[1] = c; t[2] = b;
+            t[3] = b; t[4] = c; t[5] = d;
+        }
+    }, 64);
+
+    return m;
+}
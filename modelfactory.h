@@ -21,6 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef MODELFACTORY_H
 #define MODELFACTORY_H
 
+#include <functional>
+
 // forwards
 class Model;
 
@@ -31,6 +33,11 @@ class ModelFactory
 public:
     ModelFactory();
 
+    /** Sets a function that is called with the progress [0,1] during
+        the creation of larger models. If the function returns false,
+        the creation is cancelled and the create function returns NULL. */
+    void setProgressFunction(std::function<bool(float)> func) { progressFunc_ = func; }
+
     /** Create a cube model */
     Model * createCube(float sidelength) const;
 
@@ -42,6 +49,18 @@ public:
 
     /** Create the famous OpenGL teapot */
     Model * createTeapot(float scale);
+
+    /** Create a flat grid in the x/z plane, facing up,
+        with @p segmentsU * @p segmentsV quads */
+    Model * createGrid(float sidelength_x, float sidelength_z,
+                       unsigned int segmentsU, unsigned int segmentsV) const;
+
+private:
+
+    /** Reports the progress, returns false when cancelled */
+    bool progress_(float p) const { return !progressFunc_ || progressFunc_(p); }
+
+    std::function<bool(float)> progressFunc_;
 };
 
 #endif // MODELFACTORY_H
@@ -0,0 +1,294 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <memory>
+#include <algorithm>
+#include <iostream>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QRegularExpression>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOffscreenSurface>
+#include <QGuiApplication>
+
+#include "offscreenrenderer.h"
+#include "glsl.h"
+#include "model.h"
+#include "modelfactory.h"
+#include "appsettings.h"
+
+namespace {
+
+    QString readFile(const QString& filename)
+    {
+        QFile f(filename);
+        if (!f.open(QFile::ReadOnly))
+            return QString();
+        return QString::fromUtf8(f.readAll());
+    }
+
+    /** Returns the value after @p name or @p def */
+    QString argValue(const QStringList& args, const QString& name, const QString& def = QString())
+    {
+        const int i = args.indexOf(name);
+        return (i >= 0 && i + 1 < args.size()) ? args[i + 1] : def;
+    }
+
+} // namespace
+
+
+OffscreenRenderer::OffscreenRenderer()
+{
+}
+
+QString OffscreenRenderer::frameFile_(const QString& pattern, int frame, int numFrames)
+{
+    QString fn = pattern;
+
+    // number the files anyway
+    if (!fn.contains("%1") && numFrames > 1)
+    {
+        const QFileInfo info(fn);
+        fn = info.path() + "/" + info.completeBaseName() + "_%1." + info.suffix();
+    }
+
+    return fn.contains("%1") ? fn.arg(frame, 4, 10, QChar('0')) : fn;
+}
+
+void OffscreenRenderer::applyUniforms_(Glsl& glsl, const QStringList& uniforms)
+{
+    for (auto &spec : uniforms)
+    {
+        const int eq = spec.indexOf('=');
+        if (eq <= 0)
+        {
+            log_ += QString("invalid uniform '%1', expected name=values\n").arg(spec);
+            continue;
+        }
+        const QString name = spec.left(eq).trimmed();
+        const QStringList values = spec.mid(eq + 1).split(QRegularExpression("[,\\s]+"),
+                                                          QString::SkipEmptyParts);
+
+        Uniform * u = 0;
+        for (size_t i=0; i<glsl.numUniforms() && !u; ++i)
+            if (glsl.getUniform(i)->name() == name)
+                u = glsl.getUniform(i);
+        if (!u)
+        {
+            log_ += QString("uniform '%1' is not used by the shader\n").arg(name);
+            continue;
+        }
+
+        for (int i=0; i<std::min(4, values.size()); ++i)
+        {
+            u->floats[i] = values[i].toFloat();
+            u->ints[i] = values[i].toInt();
+        }
+        u->setChanged();
+    }
+}
+
+bool OffscreenRenderer::render(const Settings& set)
+{
+    log_.clear();
+
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setDepthBufferSize(24);
+
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (!context.create() || !context.makeCurrent(&surface))
+    {
+        log_ += QString("could not create opengl context on qpa platform '%1'%2, "
+                        "set QT_QPA_PLATFORM to try another one\n")
+                .arg(QGuiApplication::platformName())
+                .arg(qgetenv("EGL_PLATFORM").isEmpty() ? QString()
+                     : QString(" with EGL_PLATFORM=%1")
+                        .arg(QString::fromLocal8Bit(qgetenv("EGL_PLATFORM"))));
+        return false;
+    }
+    QOpenGLFunctions * gl = context.functions();
+
+    // render target
+    QOpenGLFramebufferObjectFormat fboFormat;
+    fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    QOpenGLFramebufferObject fbo(set.width, set.height, fboFormat);
+    if (!fbo.isValid() || !fbo.bind())
+    {
+        log_ += "could not create framebuffer object\n";
+        return false;
+    }
+
+    // --- shader ---
+
+    Glsl glsl;
+    glsl.setVertexSource(set.vertexFile.isEmpty()
+                            ? appSettings->getValue("vertex_source").toString()
+                            : readFile(set.vertexFile), set.vertexFile);
+    glsl.setFragmentSource(set.fragmentFile.isEmpty()
+                            ? appSettings->getValue("fragment_source").toString()
+                            : readFile(set.fragmentFile), set.fragmentFile);
+    if (!glsl.compile())
+    {
+        log_ += glsl.log();
+        glsl.releaseGL();
+        return false;
+    }
+
+    applyUniforms_(glsl, set.uniforms);
+
+    // --- model (as in ModelBuilder) ---
+
+    const float scale = ModelBuilder::Settings().scale;
+    ModelFactory f;
+    std::unique_ptr<Model> model;
+    switch (set.shape)
+    {
+        case ModelBuilder::Settings::S_BOX:    model.reset(f.createCube(scale)); break;
+        case ModelBuilder::Settings::S_SPHERE: model.reset(f.createUVSphere(scale, 20, 20)); break;
+        case ModelBuilder::Settings::S_GRID:   model.reset(f.createGrid(scale*2, scale*2, 100, 100)); break;
+        default:                               model.reset(f.createTeapot(scale/5)); break;
+    }
+    model->setShaderLocations(glsl.getShaderLocations());
+
+    // --- render options as in RenderWidget ---
+
+    if (appSettings->getValue("RenderSettings/doDepthTest").toBool())
+        gl->glEnable(GL_DEPTH_TEST);
+    if (appSettings->getValue("RenderSettings/doCullFace").toBool())
+        gl->glEnable(GL_CULL_FACE);
+    gl->glFrontFace(appSettings->getValue("RenderSettings/doFrontFaceCCW").toBool()
+                    ? GL_CCW : GL_CW);
+    gl->glViewport(0, 0, set.width, set.height);
+
+    const float aspect = (float)set.width / set.height;
+    const Mat4 projection = glm::perspective(63.f, aspect, 0.1f, 1000.0f);
+
+    bool ok = true;
+    for (int frame=0; frame<set.frames && ok; ++frame)
+    {
+        gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        const Mat4 view = glm::translate(Mat4(), Vec3(0, 0, -set.distance))
+                        * glm::rotate(Mat4(), glm::radians(set.turntable * frame), Vec3(0, 1, 0));
+
+        glsl.activate();
+        glsl.sendUniforms();
+        glsl.sendSpecialUniforms(projection, view,
+                                 set.startTime + frame * set.timeStep, aspect);
+        model->draw();
+        glsl.deactivate();
+
+        const QString fn = frameFile_(set.output, frame, set.frames);
+        if (!fbo.toImage().save(fn))
+        {
+            log_ += QString("could not write %1\n").arg(fn);
+            ok = false;
+        }
+    }
+
+    model->releaseGL();
+    glsl.releaseGL();
+    fbo.release();
+
+    return ok;
+}
+
+int OffscreenRenderer::exec(const QStringList& args)
+{
+    Settings set;
+
+    set.vertexFile = argValue(args, "--vertex");
+    set.fragmentFile = argValue(args, "--fragment");
+    set.output = argValue(args, "--output", set.output);
+
+    const QString shape = argValue(args, "--model", "teapot");
+    if (shape == "box")
+        set.shape = ModelBuilder::Settings::S_BOX;
+    else if (shape == "sphere")
+        set.shape = ModelBuilder::Settings::S_SPHERE;
+    else if (shape == "grid")
+        set.shape = ModelBuilder::Settings::S_GRID;
+    else if (shape != "teapot")
+    {
+        std::cerr << "unknown model '" << shape.toStdString() << "'\n";
+        return 2;
+    }
+
+    const QStringList size = argValue(args, "--size", "512x512").split('x');
+    if (size.size() == 2)
+    {
+        set.width = size[0].toInt();
+        set.height = size[1].toInt();
+    }
+    set.frames = argValue(args, "--frames", "1").toInt();
+    set.startTime = argValue(args, "--start-time", "0").toFloat();
+    set.timeStep = argValue(args, "--time-step", QString::number(set.timeStep)).toFloat();
+    set.distance = argValue(args, "--distance", QString::number(set.distance)).toFloat();
+    set.turntable = argValue(args, "--turntable", "0").toFloat();
+
+    if (set.width <= 0 || set.height <= 0 || set.frames <= 0)
+    {
+        std::cerr << "usage: scheeder --render [--vertex <file>] [--fragment <file>]\n"
+                     "         [--model box|sphere|teapot|grid] [--size <w>x<h>]\n"
+                     "         [--frames <n>] [--start-time <sec>] [--time-step <sec>]\n"
+                     "         [--distance <z>] [--turntable <degree per frame>]\n"
+                     "         [--uniform <name>=<v1>,<v2>..]... [--uniforms <file>]\n"
+                     "         [--output <file%1.png>]\n";
+        return 2;
+    }
+
+    // uniform values from file, then from the command line
+    const QString ufile = argValue(args, "--uniforms");
+    if (!ufile.isEmpty())
+    {
+        QFile f(ufile);
+        if (!f.open(QFile::ReadOnly | QFile::Text))
+        {
+            std::cerr << "could not read " << ufile.toStdString() << "\n";
+            return 2;
+        }
+        const QStringList lines = QString::fromUtf8(f.readAll()).split('\n');
+        for (auto line : lines)
+        {
+            line = line.left(line.indexOf('#')).trimmed();
+            if (!line.isEmpty())
+                set.uniforms << line;
+        }
+    }
+    for (int i=0; i<args.size() - 1; ++i)
+        if (args[i] == "--uniform")
+            set.uniforms << args[i + 1];
+
+    OffscreenRenderer r;
+    const bool ok = r.render(set);
+    std::cerr << r.log().toStdString();
+
+    return ok ? 0 : 1;
+}
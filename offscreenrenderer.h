@@ -0,0 +1,107 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef OFFSCREENRENDERER_H
+#define OFFSCREENRENDERER_H
+
+#include <QString>
+#include <QStringList>
+
+#include "modelbuilder.h"
+
+class Glsl;
+
+/** @brief Renders a shader on a model into image files, without a window.
+
+    <p>The rendering goes into a framebuffer object of an offscreen
+    context. Without an X display, main() selects the eglfs plugin on
+    Mesa's surfaceless EGL platform, so no display server is needed. It uses the same Glsl, Model, ModelFactory and
+    Glsl::sendSpecialUniforms() as the RenderWidget, and the render
+    options from the AppSettings.</p>
+
+    Usage from the command line:
+    @code
+    scheeder --render [--vertex <file>] [--fragment <file>]
+                      [--model box|sphere|teapot|grid] [--size <w>x<h>]
+                      [--frames <n>] [--start-time <sec>] [--time-step <sec>]
+                      [--distance <z>] [--turntable <degree per frame>]
+                      [--uniform <name>=<v1>,<v2>..]... [--uniforms <file>]
+                      [--output <file%1.png>]
+    @endcode
+    Missing sources are taken from the editor defaults.
+    A uniforms file contains one name=values per line, # starts a comment.
+    %1 in the output name is replaced by the frame number.
+*/
+class OffscreenRenderer
+{
+public:
+
+    struct Settings
+    {
+        QString vertexFile, fragmentFile,
+        /** file name with %1 for the frame number */
+                output;
+        ModelBuilder::Settings::Shape shape;
+        int width, height, frames;
+        float startTime, timeStep,
+              distance,
+        /** rotation around the y-axis per frame in degree */
+              turntable;
+        /** name=values */
+        QStringList uniforms;
+
+        Settings()
+            :   output      ("frame_%1.png"),
+                shape       (ModelBuilder::Settings::S_TEAPOT),
+                width       (512),
+                height      (512),
+                frames      (1),
+                startTime   (0.f),
+                timeStep    (1.f / 25.f),
+                distance    (10.f),
+                turntable   (0.f)
+        { }
+    };
+
+    OffscreenRenderer();
+
+    /** Messages and errors of the last render() call */
+    const QString& log() const { return log_; }
+
+    /** Renders all frames and writes the images.
+        Returns false on errors, see log(). */
+    bool render(const Settings& settings);
+
+    /** Runs the command line mode.
+        Returns 0 on success, 1 on render errors and 2 on usage errors. */
+    static int exec(const QStringList& args);
+
+private:
+
+    /** Sets the uniform values from name=values strings */
+    void applyUniforms_(Glsl& glsl, const QStringList& uniforms);
+
+    /** Returns the file name of the frame */
+    static QString frameFile_(const QString& pattern, int frame, int numFrames);
+
+    QString log_;
+};
+
+#endif // OFFSCREENRENDERER_H
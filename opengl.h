@@ -58,6 +58,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #   include <GL/gl.h>
 #   include <GL/glext.h>
 
+    // glGetProgramBinary() and glProgramBinary() are available
+#   ifdef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#       define SCH_HAS_PROGRAM_BINARY
+#   endif
+
 #elif defined(Q_OS_WIN)
 
 #   include <QOpenGLFunctions_3_3_Core>
@@ -66,9 +71,36 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #endif
 
 
+// KHR_parallel_shader_compile, might be missing in older headers
+#ifndef GL_COMPLETION_STATUS_KHR
+#   define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// ARB_pipeline_statistics_query (core in 4.6)
+#ifndef GL_VERTICES_SUBMITTED_ARB
+#   define GL_VERTICES_SUBMITTED_ARB            0x82EE
+#   define GL_PRIMITIVES_SUBMITTED_ARB          0x82EF
+#   define GL_VERTEX_SHADER_INVOCATIONS_ARB     0x82F0
+#   define GL_FRAGMENT_SHADER_INVOCATIONS_ARB   0x82F4
+#   define GL_CLIPPING_INPUT_PRIMITIVES_ARB     0x82F6
+#   define GL_CLIPPING_OUTPUT_PRIMITIVES_ARB    0x82F7
+#endif
+
 /** Maximum number of texture slots */
 #define SCH_MAX_TEXTURES 4
 
+/** Fixed vertex attribute locations.
+    The attribute names from AppSettings are bound to these
+    before linking, so the locations stay the same across recompiles. */
+#define SCH_ATTRIB_POSITION 0
+#define SCH_ATTRIB_NORMAL   1
+#define SCH_ATTRIB_COLOR    2
+#define SCH_ATTRIB_TEXCOORD 3
+
+/** Uniform buffer binding point of the per-frame block.
+    User uniform blocks are bound to the following points. */
+#define SCH_FRAME_BLOCK_BINDING 0
+
 /** Exchange of common vertex attribute and uniform locations.
     @note This is totally specific to this application. The
     code names of these are defined in AppSettings.
@@ -0,0 +1,68 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+/** @file
+    @brief simple helper to distribute loops over threads.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/** Returns the number of threads to use for parallel loops */
+inline size_t numParallelThreads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/** Splits the range [0, num) into consecutive chunks and calls
+    @p func(begin, end) for each chunk on it's own thread.
+    The calling thread works on the first chunk and
+    the function returns when all chunks are done.
+    No chunk will be smaller than @p minChunk, so small
+    loops run entirely on the calling thread.
+    @p func must not write to data used by other chunks! */
+template <typename F>
+void parallelFor(size_t num, F func, size_t minChunk = 10000)
+{
+    const size_t
+        numThreads = std::max(size_t(1), std::min(numParallelThreads(),
+                                                  num / std::max(size_t(1), minChunk))),
+        chunk = (num + numThreads - 1) / numThreads;
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (size_t i=1; i<numThreads; ++i)
+    {
+        const size_t begin = i * chunk,
+                     end = std::min(num, begin + chunk);
+        if (begin < end)
+            threads.push_back(std::thread(func, begin, end));
+    }
+
+    func(size_t(0), std::min(num, chunk));
+
+    for (auto & t : threads)
+        t.join();
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,203 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <cstring>
+
+#include "pipelinestatistics.h"
+#include "debug.h"
+
+PipelineStatistics::PipelineStatistics()
+    :   setIndex_       (0),
+        active_         (false),
+        glInitialized_  (false),
+        hasResult_      (false)
+{
+    for (int i=0; i<numSets_; ++i)
+    {
+        for (int c=0; c<C_MAX; ++c)
+            sets_[i].id[c] = 0;
+        sets_[i].pending = false;
+    }
+
+    for (int c=0; c<C_MAX; ++c)
+    {
+        supported_[c] = false;
+        values_[c] = 0;
+    }
+}
+
+const char * PipelineStatistics::name(Counter c)
+{
+    switch (c)
+    {
+        case C_VERTICES_SUBMITTED:          return "vertices submitted";
+        case C_PRIMITIVES_SUBMITTED:        return "primitives submitted";
+        case C_VERTEX_SHADER_INVOCATIONS:   return "vertex shader invocations";
+        case C_PRIMITIVES_GENERATED:        return "primitives generated";
+        case C_CLIPPING_INPUT:              return "clipping input primitives";
+        case C_CLIPPING_OUTPUT:             return "clipping output primitives";
+        case C_FRAGMENT_SHADER_INVOCATIONS: return "fragment shader invocations";
+        case C_MAX: break;
+    }
+    return "";
+}
+
+GLenum PipelineStatistics::target_(Counter c)
+{
+    switch (c)
+    {
+        case C_VERTICES_SUBMITTED:          return GL_VERTICES_SUBMITTED_ARB;
+        case C_PRIMITIVES_SUBMITTED:        return GL_PRIMITIVES_SUBMITTED_ARB;
+        case C_VERTEX_SHADER_INVOCATIONS:   return GL_VERTEX_SHADER_INVOCATIONS_ARB;
+        case C_PRIMITIVES_GENERATED:        return GL_PRIMITIVES_GENERATED;
+        case C_CLIPPING_INPUT:              return GL_CLIPPING_INPUT_PRIMITIVES_ARB;
+        case C_CLIPPING_OUTPUT:             return GL_CLIPPING_OUTPUT_PRIMITIVES_ARB;
+        case C_FRAGMENT_SHADER_INVOCATIONS: return GL_FRAGMENT_SHADER_INVOCATIONS_ARB;
+        case C_MAX: break;
+    }
+    return 0;
+}
+
+void PipelineStatistics::initGL_()
+{
+#ifdef SCH_USE_QT_OPENGLFUNC
+    initializeOpenGLFunctions();
+#endif
+
+    // core since 4.6
+    GLint major = 0, minor = 0;
+    SCH_CHECK_GL( glGetIntegerv(GL_MAJOR_VERSION, &major) );
+    SCH_CHECK_GL( glGetIntegerv(GL_MINOR_VERSION, &minor) );
+    bool arb = major > 4 || (major == 4 && minor >= 6);
+
+    GLint num = 0;
+    SCH_CHECK_GL( glGetIntegerv(GL_NUM_EXTENSIONS, &num) );
+    for (GLint i=0; i<num && !arb; ++i)
+        arb = !strcmp((const char*)glGetStringi(GL_EXTENSIONS, i),
+                      "GL_ARB_pipeline_statistics_query");
+
+    for (int c=0; c<C_MAX; ++c)
+        supported_[c] = arb || c == C_PRIMITIVES_GENERATED;
+
+    for (int i=0; i<numSets_; ++i)
+        for (int c=0; c<C_MAX; ++c)
+            if (supported_[c])
+                SCH_CHECK_GL( glGenQueries(1, &sets_[i].id[c]) );
+
+    glInitialized_ = true;
+}
+
+void PipelineStatistics::releaseGL()
+{
+    if (!glInitialized_)
+        return;
+
+    for (int i=0; i<numSets_; ++i)
+    {
+        for (int c=0; c<C_MAX; ++c)
+        if (sets_[i].id[c])
+        {
+            SCH_CHECK_GL( glDeleteQueries(1, &sets_[i].id[c]) );
+            sets_[i].id[c] = 0;
+        }
+        sets_[i].pending = false;
+    }
+    glInitialized_ = false;
+}
+
+bool PipelineStatistics::isPending() const
+{
+    for (int i=0; i<numSets_; ++i)
+        if (sets_[i].pending)
+            return true;
+    return false;
+}
+
+void PipelineStatistics::begin()
+{
+    if (!glInitialized_)
+        initGL_();
+
+    // all sets in flight, skip instead of waiting
+    QuerySet& s = sets_[setIndex_];
+    active_ = !s.pending;
+    if (!active_)
+        return;
+
+    // (queries of different targets may run at the same time)
+    for (int c=0; c<C_MAX; ++c)
+        if (supported_[c])
+            SCH_CHECK_GL( glBeginQuery(target_((Counter)c), s.id[c]) );
+}
+
+void PipelineStatistics::end()
+{
+    if (!active_)
+        return;
+
+    QuerySet& s = sets_[setIndex_];
+    for (int c=0; c<C_MAX; ++c)
+        if (supported_[c])
+            SCH_CHECK_GL( glEndQuery(target_((Counter)c)) );
+
+    s.pending = true;
+    setIndex_ = (setIndex_ + 1) % numSets_;
+    active_ = false;
+}
+
+bool PipelineStatistics::readResults()
+{
+    if (!glInitialized_)
+        return false;
+
+    bool read = false;
+
+    // the set after the last used one is the oldest
+    for (int j=0; j<numSets_; ++j)
+    {
+        QuerySet& s = sets_[(setIndex_ + j) % numSets_];
+        if (!s.pending)
+            continue;
+
+        // the results of a set arrive together
+        // once the draw is through the pipeline
+        GLint available = 0;
+        SCH_CHECK_GL( glGetQueryObjectiv(s.id[C_PRIMITIVES_GENERATED],
+                                         GL_QUERY_RESULT_AVAILABLE, &available) );
+        if (!available)
+            break;
+
+        for (int c=0; c<C_MAX; ++c)
+        {
+            if (!supported_[c])
+                continue;
+
+            // make sure for this counter
+            SCH_CHECK_GL( glGetQueryObjectiv(s.id[c], GL_QUERY_RESULT_AVAILABLE, &available) );
+            if (available)
+                SCH_CHECK_GL( glGetQueryObjectui64v(s.id[c], GL_QUERY_RESULT, &values_[c]) );
+        }
+
+        s.pending = false;
+        read = hasResult_ = true;
+    }
+
+    return read;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef PIPELINESTATISTICS_H
+#define PIPELINESTATISTICS_H
+
+#include "opengl.h"
+
+/** @brief Counts the work of the pipeline between begin() and end().
+
+    <p>GL_PRIMITIVES_GENERATED is always available, the other counters
+    need ARB_pipeline_statistics_query or OpenGL 4.6.</p>
+
+    <p>Like FrameProfiler, the queries are kept in a ring and results are
+    only read when available, so they arrive one or more frames late
+    but never stall the pipeline.</p>
+*/
+class PipelineStatistics
+#ifdef SCH_USE_QT_OPENGLFUNC
+    :   protected QOpenGLFunctions_3_3_Core
+#endif
+{
+public:
+
+    enum Counter
+    {
+        C_VERTICES_SUBMITTED,
+        C_PRIMITIVES_SUBMITTED,
+        C_VERTEX_SHADER_INVOCATIONS,
+        C_PRIMITIVES_GENERATED,
+        C_CLIPPING_INPUT,
+        C_CLIPPING_OUTPUT,
+        C_FRAGMENT_SHADER_INVOCATIONS,
+        C_MAX
+    };
+
+    PipelineStatistics();
+
+    /** Returns a readable name for the counter */
+    static const char * name(Counter);
+
+    // ----------- query ---------------------
+
+    /** Returns true if the driver provides the counter.
+        Valid after the first begin() */
+    bool isSupported(Counter c) const { return supported_[c]; }
+
+    /** Returns true if any results have been read */
+    bool hasResult() const { return hasResult_; }
+
+    /** Returns true if queries are waiting for their results */
+    bool isPending() const;
+
+    /** Returns the last read value of the counter */
+    GLuint64 value(Counter c) const { return values_[c]; }
+
+    // ---------- measurement -------------
+
+    /** Starts counting, if a set of query objects is free */
+    void begin();
+
+    /** Stops counting */
+    void end();
+
+    /** Reads the finished results without waiting.
+        Returns true if a new result was read. */
+    bool readResults();
+
+    /** Deletes the query objects */
+    void releaseGL();
+
+private:
+
+    void initGL_();
+
+    /** Returns the query target of the counter */
+    static GLenum target_(Counter);
+
+    static const int numSets_ = 4;
+
+    struct QuerySet
+    {
+        GLuint id[C_MAX];
+        bool pending;
+    };
+
+    QuerySet sets_[numSets_];
+    /** next set to use */
+    int setIndex_;
+    bool active_, glInitialized_, hasResult_;
+
+    bool supported_[C_MAX];
+    GLuint64 values_[C_MAX];
+};
+
+#endif // PIPELINESTATISTICS_H
@@ -0,0 +1,227 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QCryptographicHash>
+
+#include "programcache.h"
+
+// the single instance
+ProgramCache * programCache = 0;
+
+namespace {
+
+    /** file header: magic, version, lastUse, format */
+    const quint32 cacheMagic = 0x53434850; // 'SCHP'
+    const quint32 cacheVersion = 1;
+    const qint64 headerSize = 4 + 4 + 8 + 4;
+    /** offset of the lastUse field */
+    const qint64 lastUseOffset = 8;
+
+    qint64 now() { return QDateTime::currentMSecsSinceEpoch(); }
+
+} // namespace
+
+
+ProgramCache::ProgramCache(const QString &directory, qint64 maxSize)
+    :   directory_  (directory),
+        maxSize_    (maxSize),
+        size_       (0),
+        hits_       (0),
+        misses_     (0)
+{
+    QDir().mkpath(directory_);
+    scan_();
+    evict_();
+}
+
+QByteArray ProgramCache::makeKey(const QString &vertexSource,
+                                 const QString &fragmentSource,
+                                 const QString &attributeBindings,
+                                 const QString &driver)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    // separate the parts, so moving text between them changes the key
+    hash.addData(vertexSource.toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(fragmentSource.toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(attributeBindings.toUtf8());
+    hash.addData("\0", 1);
+    hash.addData(driver.toUtf8());
+    return hash.result().toHex();
+}
+
+QString ProgramCache::fileName_(const QByteArray &key) const
+{
+    return directory_ + "/" + QString::fromLatin1(key) + ".bin";
+}
+
+void ProgramCache::scan_()
+{
+    entries_.clear();
+    size_ = 0;
+
+    QDir dir(directory_);
+    const QStringList files = dir.entryList(QStringList() << "*.bin", QDir::Files);
+    for (auto &f : files)
+    {
+        QFile file(dir.filePath(f));
+        if (!file.open(QFile::ReadOnly))
+            continue;
+
+        QDataStream in(&file);
+        quint32 magic, version;
+        Entry e;
+        in >> magic >> version >> e.lastUse;
+
+        if (in.status() != QDataStream::Ok
+            || magic != cacheMagic || version != cacheVersion)
+        {
+            // not ours or outdated
+            file.close();
+            file.remove();
+            continue;
+        }
+
+        e.size = file.size();
+        entries_.insert(f.left(f.size() - 4).toLatin1(), e);
+        size_ += e.size;
+    }
+}
+
+bool ProgramCache::load(const QByteArray &key, unsigned int &format, QByteArray &binary)
+{
+    QMutexLocker lock(&mutex_);
+
+    auto i = entries_.find(key);
+    if (i == entries_.end())
+    {
+        ++misses_;
+        return false;
+    }
+
+    QFile file(fileName_(key));
+    if (!file.open(QFile::ReadWrite))
+    {
+        size_ -= i.value().size;
+        entries_.erase(i);
+        ++misses_;
+        return false;
+    }
+
+    QDataStream io(&file);
+    quint32 magic, version, fmt;
+    qint64 lastUse;
+    io >> magic >> version >> lastUse >> fmt;
+    binary = file.readAll();
+
+    if (io.status() != QDataStream::Ok || binary.isEmpty())
+    {
+        file.close();
+        remove_(key);
+        ++misses_;
+        return false;
+    }
+
+    // touch
+    i.value().lastUse = now();
+    file.seek(lastUseOffset);
+    io << i.value().lastUse;
+
+    format = fmt;
+    ++hits_;
+    return true;
+}
+
+void ProgramCache::store(const QByteArray &key, unsigned int format, const QByteArray &binary)
+{
+    QMutexLocker lock(&mutex_);
+
+    // larger than the whole cache
+    if (headerSize + binary.size() > maxSize_)
+        return;
+
+    remove_(key);
+
+    QFile file(fileName_(key));
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return;
+
+    Entry e;
+    e.lastUse = now();
+    e.size = headerSize + binary.size();
+
+    QDataStream out(&file);
+    out << cacheMagic << cacheVersion << e.lastUse << (quint32)format;
+    if (out.writeRawData(binary.constData(), binary.size()) != binary.size())
+    {
+        file.close();
+        file.remove();
+        return;
+    }
+
+    entries_.insert(key, e);
+    size_ += e.size;
+
+    evict_();
+}
+
+void ProgramCache::remove(const QByteArray &key)
+{
+    QMutexLocker lock(&mutex_);
+    remove_(key);
+}
+
+void ProgramCache::remove_(const QByteArray &key)
+{
+    auto i = entries_.find(key);
+    if (i == entries_.end())
+        return;
+
+    // (key might reference the map entry)
+    QFile::remove(fileName_(key));
+    size_ -= i.value().size;
+    entries_.erase(i);
+}
+
+void ProgramCache::clear()
+{
+    QMutexLocker lock(&mutex_);
+    while (!entries_.isEmpty())
+        remove_(entries_.firstKey());
+}
+
+void ProgramCache::evict_()
+{
+    while (size_ > maxSize_ && !entries_.isEmpty())
+    {
+        // find least recently used
+        auto lru = entries_.begin();
+        for (auto i = entries_.begin(); i != entries_.end(); ++i)
+            if (i.value().lastUse < lru.value().lastUse)
+                lru = i;
+
+        remove_(lru.key());
+    }
+}
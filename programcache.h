@@ -0,0 +1,119 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+
+/** On-disk cache for linked program binaries.
+
+    <p>Each entry is a file in directory() named after the hex key.
+    The file starts with a small header containing the last time of use,
+    which is rewritten in place on each hit. When the total size exceeds
+    maxSize(), the least recently used entries are removed.</p>
+
+    <p>The class only deals with bytes, the opengl part
+    (glGetProgramBinary/glProgramBinary) is done by Glsl.
+    All methods, except the constructor, are thread-safe.</p>
+*/
+class ProgramCache
+{
+public:
+
+    /** Opens the cache in @p directory, which is created if needed.
+        @p maxSize is the maximum number of bytes of all entries. */
+    ProgramCache(const QString& directory, qint64 maxSize);
+
+    // ----------- query ---------------------
+
+    const QString& directory() const { return directory_; }
+
+    qint64 maxSize() const { return maxSize_; }
+
+    /** Returns the number of bytes of all entries */
+    qint64 size() const { QMutexLocker lock(&mutex_); return size_; }
+
+    /** Returns the number of entries */
+    int numEntries() const { QMutexLocker lock(&mutex_); return entries_.size(); }
+
+    /** Number of successful load() calls */
+    int hits() const { QMutexLocker lock(&mutex_); return hits_; }
+
+    /** Number of unsuccessful load() calls */
+    int misses() const { QMutexLocker lock(&mutex_); return misses_; }
+
+    // ----------- access --------------------
+
+    /** Creates a key from all the things that make a program binary unique.
+        This is a hash of the sources, the attribute bindings and the driver string. */
+    static QByteArray makeKey(const QString& vertexSource,
+                              const QString& fragmentSource,
+                              const QString& attributeBindings,
+                              const QString& driver);
+
+    /** Looks up the binary for @p key.
+        Returns true and fills @p format and @p binary on success. */
+    bool load(const QByteArray& key, unsigned int& format, QByteArray& binary);
+
+    /** Stores the binary for @p key and evicts old entries if needed */
+    void store(const QByteArray& key, unsigned int format, const QByteArray& binary);
+
+    /** Removes an entry, e.g. when the driver refused the binary */
+    void remove(const QByteArray& key);
+
+    /** Removes all entries */
+    void clear();
+
+private:
+
+    struct Entry
+    {
+        qint64 size, lastUse;
+    };
+
+    /** Reads the headers of all files in the directory */
+    void scan_();
+
+    /** remove() without locking */
+    void remove_(const QByteArray& key);
+
+    /** Removes least recently used entries until size() <= maxSize() */
+    void evict_();
+
+    QString fileName_(const QByteArray& key) const;
+
+    QString directory_;
+    qint64 maxSize_, size_;
+    int hits_, misses_;
+
+    QMap<QByteArray, Entry> entries_;
+
+    mutable QMutex mutex_;
+};
+
+/** Single instance, may be NULL */
+extern ProgramCache * programCache;
+
+#endif // PROGRAMCACHE_H
@@ -21,10 +21,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstring>
+
+#include <QTimer>
+#include <QPainter>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QWindow>
+
 #include "renderwidget.h"
 #include "appsettings.h"
 #include "model.h"
 #include "glsl.h"
+#include "modelbenchmark.h"
+#include "framescheduler.h"
 #include "debug.h"
 
 
@@ -37,7 +47,14 @@ RenderWidget::RenderWidget(QWidget *parent,
     newShader_      (0),
     requestCompile_ (false),
     requestTextureUpdate_(false),
-    doAnimation_    (false)
+    requestBenchmark_(false),
+    doAnimation_    (false),
+    benchmarkTest_  (0),
+    lastUniformUploads_(0),
+    scheduler_      (new FrameScheduler(this)),
+    presentIntervalMs_(1000. / 60.),
+    numPresented_   (0),
+    doPipelineStats_(false)
 {
     setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     setMinimumSize(256,256);
@@ -45,15 +62,30 @@ RenderWidget::RenderWidget(QWidget *parent,
     for (int i=0; i<4; ++i)
         texture_[i] = -1;
 
+    connect(scheduler_, SIGNAL(frameDue()), this, SLOT(update()));
+    statsTimer_.start();
+    presentTimer_.start();
+    pipelineTimer_.start();
+
     reconfigure();
 }
 
 RenderWidget::~RenderWidget()
 {
+    makeCurrent();
+    capture_.stop();
+    capture_.releaseGL();
+    profiler_.releaseGL();
+    pipelineStats_.releaseGL();
+
     if (model_)
         delete model_;
     if (shader_)
+    {
+        shader_->releaseGL();
         delete shader_;
+    }
+    delete newShader_;
 }
 
 void RenderWidget::reconfigure()
@@ -62,6 +94,21 @@ void RenderWidget::reconfigure()
     doCullFace_ = appSettings->getValue("RenderSettings/doCullFace").toBool();
     doFrontFaceCCW_ = appSettings->getValue("RenderSettings/doFrontFaceCCW").toBool();
     doDrawCoords_ = appSettings->getValue("RenderSettings/doDrawCoords").toBool();
+    doShowHud_ = appSettings->getValue("RenderSettings/doShowHud").toBool();
+
+    // uncapped frames are presented at display rate in paintGL(),
+    // so a vsync'ed swap does not limit the frame rate
+    const double fps = appSettings->getValue("RenderSettings/targetFps").toDouble();
+    scheduler_->setTargetFps(fps);
+    setAutoBufferSwap(fps > 0.);
+    updatePresentInterval_();
+
+    // the frame rate of a capture is fixed in it's header
+    if (capture_.isCapturing() && capture_.fps() != captureFps_())
+    {
+        stopCapture();
+        emit statusMessage(tr("Capture stopped, the frame rate has changed"));
+    }
 
     // set image filenames
     for (int i=0; i<SCH_MAX_TEXTURES; ++i)
@@ -76,6 +123,9 @@ void RenderWidget::reconfigure()
 
 void RenderWidget::setModel(Model * m)
 {
+    // a model that never made it to the gpu
+    if (newModel_ && newModel_ != m)
+        delete newModel_;
     newModel_ = m;
     update();
 }
@@ -86,12 +136,25 @@ void RenderWidget::setShader(Glsl *s)
     update();
 }
 
+void RenderWidget::setPipelineStatistics(bool enable)
+{
+    doPipelineStats_ = enable;
+    update();
+}
+
 void RenderWidget::requestCompileShader()
 {
     requestCompile_ = true;
     update();
 }
 
+void RenderWidget::requestBenchmark(int test)
+{
+    benchmarkTest_ = test;
+    requestBenchmark_ = true;
+    update();
+}
+
 void RenderWidget::initializeGL()
 {
     Basic3DWidget::initializeGL();
@@ -101,6 +164,17 @@ void RenderWidget::paintGL()
 {
     //glGetError(); /* clear previous errors */
 
+    scheduler_->beginFrame();
+    profiler_.beginFrame();
+
+    // results of previous frames, a few times per second
+    if (doPipelineStats_ && pipelineStats_.readResults()
+        && (!doAnimation_ || pipelineTimer_.elapsed() >= 250))
+    {
+        pipelineTimer_.restart();
+        emit pipelineStatistics(pipelineText_());
+    }
+
     applyOptions_();
 
     // clear screen and such
@@ -114,7 +188,9 @@ void RenderWidget::paintGL()
     if (requestTextureUpdate_)
     {
         requestTextureUpdate_ = false;
+        profiler_.beginPhase(FrameProfiler::S_TEXTURES);
         initTextures_();
+        profiler_.endPhase(FrameProfiler::S_TEXTURES);
     }
 
     bool sendAttributes = false;
@@ -141,8 +217,8 @@ void RenderWidget::paintGL()
         // remove old resources
         if (shader_)
         {
-            if (shader_->ready())
-                shader_->releaseGL();
+            // (also a never compiled shader owns the compile thread and caches)
+            shader_->releaseGL();
             delete shader_;
         }
         // exchange
@@ -152,25 +228,75 @@ void RenderWidget::paintGL()
 
     if (shader_)
     {
+        profiler_.beginPhase(FrameProfiler::S_COMPILE);
+
         if (requestCompile_)
         {
             requestCompile_ = false;
-            // (re-)compile shader
-            if (shader_->compile())
-                // and send the (possibly new) vertex attribute locations
-                // to the model
-                sendAttributes = true;
-            // also tell mainwindow
-            // to update the uniform widgets
-            emit shaderCompiled();
+            // start (re-)compiling the shader,
+            // the previous program is used until it's finished
+            if (!shader_->beginCompile())
+                emit shaderCompiled();
+        }
+
+        if (shader_->isCompiling())
+        {
+            if (shader_->pollCompile())
+            {
+                if (shader_->compileSucceeded())
+                    // send the (possibly new) vertex attribute locations
+                    // to the model
+                    sendAttributes = true;
+                // also tell mainwindow
+                // to update the uniform widgets
+                emit shaderCompiled();
+            }
+            else
+                // look again soon
+                QTimer::singleShot(10, this, SLOT(update()));
         }
 
+        profiler_.endPhase(FrameProfiler::S_COMPILE);
+
         // activate shader and update uniform values
         if (shader_->ready())
         {
+            profiler_.beginPhase(FrameProfiler::S_UNIFORMS);
             shader_->activate();
             shader_->sendUniforms();
             sendSpecialUniforms_();
+            profiler_.endPhase(FrameProfiler::S_UNIFORMS);
+
+            // reported with the frame statistics
+            lastUniformUploads_ = shader_->numUniformUploads();
+
+            if (requestBenchmark_)
+            {
+                requestBenchmark_ = false;
+                ModelBenchmark bench;
+                if (benchmarkTest_ == ModelBenchmark::T_FROZEN)
+                {
+                    const QString text =
+                            bench.compareFrozen(shader_, model_,
+                                                [=](){ sendSpecialUniforms_(); });
+
+                    // the benchmark recompiled the shader
+                    if (shader_->ready())
+                    {
+                        shader_->activate();
+                        shader_->sendUniforms();
+                        sendSpecialUniforms_();
+                    }
+                    sendAttributes = true;
+                    emit shaderCompiled();
+
+                    emit benchmarkFinished(text);
+                }
+                else
+                    emit benchmarkFinished(
+                            bench.run((ModelBenchmark::Test)benchmarkTest_,
+                                      shader_->getShaderLocations()) );
+            }
         }
     }
 
@@ -181,59 +307,245 @@ void RenderWidget::paintGL()
             model_->setShaderLocations(shader_->getShaderLocations());
 
         // and finally draw
+        profiler_.beginPhase(FrameProfiler::S_DRAW);
+        if (doShowHud_)
+            profiler_.beginGpu();
+        if (doPipelineStats_)
+            pipelineStats_.begin();
+
         if (model_->isVAO())
             model_->draw();
         else
             model_->drawOldschool();
+
+        if (doPipelineStats_)
+        {
+            pipelineStats_.end();
+            // no next frame to read the result
+            if (!doAnimation_)
+                QTimer::singleShot(20, this, SLOT(readPipelineStatistics_()));
+        }
+        if (doShowHud_)
+            profiler_.endGpu();
+        profiler_.endPhase(FrameProfiler::S_DRAW);
     }
 
     if (shader_ && shader_->activated())
         shader_->deactivate();
 
+    profiler_.endFrame();
+
+    // present uncapped frames only at display rate
+    const bool present = autoBufferSwap()
+        || !doAnimation_ || presentTimer_.nsecsElapsed() >= presentIntervalMs_ * 1000000.;
 
-    // render again!
-    if (doAnimation_)
-        update();
+    // record the scene without the overlay, only the paced animation
+    // frames that are shown, so the file plays at captureFps_()
+    if (capture_.isCapturing() && doAnimation_
+        && scheduler_->isScheduledFrame() && present
+        && !capture_.capture(width(), height()))
+    {
+        stopCapture();
+        emit statusMessage(tr("Capture stopped, the window size has changed"));
+    }
+
+    if (doShowHud_)
+        paintHud_();
+
+    if (!autoBufferSwap() && present)
+    {
+        swapBuffers();
+        presentTimer_.restart();
+        ++numPresented_;
+    }
+
+    // schedule the next frame
+    scheduler_->endFrame();
+
+    if (doAnimation_ && statsTimer_.elapsed() >= 1000)
+    {
+        emitFrameStats_(statsTimer_.restart() / 1000.);
+        numPresented_ = 0;
+    }
 }
 
-void RenderWidget::sendSpecialUniforms_()
+void RenderWidget::paintHud_()
 {
-    if ((int)shader_->getShaderLocations().projection>=0)
+    // QPainter would swap the buffers at the end
+    const bool autoSwap = autoBufferSwap();
+    setAutoBufferSwap(false);
     {
-        SCH_CHECK_GL( glUniformMatrix4fv(
-                        shader_->getShaderLocations().projection,
-                        1, GL_FALSE, glm::value_ptr(projectionMatrix())) );
+        QPainter p(this);
+        profiler_.paint(p, QRect(4, 4, 300, 180));
     }
-    if ((int)shader_->getShaderLocations().view>=0)
+    setAutoBufferSwap(autoSwap);
+
+    // restore what the paint engine changed
+    SCH_CHECK_GL( glViewport(0, 0, width(), height()) );
+    SCH_CHECK_GL( glDisable(GL_SCISSOR_TEST) );
+    SCH_CHECK_GL( glDisable(GL_STENCIL_TEST) );
+    SCH_CHECK_GL( glDisable(GL_BLEND) );
+    for (int i=0; i<SCH_MAX_TEXTURES; ++i)
     {
-        SCH_CHECK_GL( glUniformMatrix4fv(
-                        shader_->getShaderLocations().view,
-                        1, GL_FALSE, glm::value_ptr(transformationMatrix())) );
+        SCH_CHECK_GL( glActiveTexture(GL_TEXTURE0 + i) );
+        SCH_CHECK_GL( glBindTexture(GL_TEXTURE_2D, texture_[i] != -1 ? texture_[i] : 0) );
     }
-    if ((int)shader_->getShaderLocations().time>=0)
+    SCH_CHECK_GL( glActiveTexture(GL_TEXTURE0) );
+}
+
+void RenderWidget::readPipelineStatistics_()
+{
+    if (!doPipelineStats_ || doAnimation_)
+        return;
+
+    makeCurrent();
+    if (pipelineStats_.readResults())
+        emit pipelineStatistics(pipelineText_());
+    else if (pipelineStats_.isPending())
+        QTimer::singleShot(20, this, SLOT(readPipelineStatistics_()));
+}
+
+QString RenderWidget::pipelineText_() const
+{
+    QString text;
+    if (model_)
+        text += tr("model: %1 vertices, %2 triangles\n\n")
+                .arg(model_->numVertices()).arg(model_->numTriangles());
+
+    for (int i=0; i<PipelineStatistics::C_MAX; ++i)
     {
-        SCH_CHECK_GL( glUniform1f(
-                          shader_->getShaderLocations().time, getTime()) );
+        const auto c = (PipelineStatistics::Counter)i;
+        text += QString("%1 ").arg(QString(PipelineStatistics::name(c)), -28);
+        if (pipelineStats_.isSupported(c))
+            text += QString("%1\n").arg(pipelineStats_.value(c), 12);
+        else
+            text += QString("%1\n").arg("n/a", 12);
     }
-    if ((int)shader_->getShaderLocations().aspect>=0)
+
+    if (!pipelineStats_.isSupported(PipelineStatistics::C_VERTEX_SHADER_INVOCATIONS))
+        return text + tr("\n(no ARB_pipeline_statistics_query)");
+
+    // how well the post-transform cache and the depth test work
+    text += "\n";
+    if (model_ && model_->numVertices())
+        text += tr("vertex invocations per vertex  %1\n")
+                .arg((double)pipelineStats_.value(PipelineStatistics::C_VERTEX_SHADER_INVOCATIONS)
+                     / model_->numVertices(), 0, 'f', 2);
+    if (width() * height() > 0)
+        text += tr("fragments per pixel            %1\n")
+                .arg((double)pipelineStats_.value(PipelineStatistics::C_FRAGMENT_SHADER_INVOCATIONS)
+                     / (width() * height()), 0, 'f', 2);
+
+    return text;
+}
+
+void RenderWidget::emitFrameStats_(double seconds)
+{
+    const FrameScheduler::Stats s = scheduler_->stats();
+    if (s.frames <= 0)
+        return;
+
+    // uncapped frames are rendered faster than they are shown
+    const QString rate = autoBufferSwap()
+            ? tr("%1 fps").arg(s.fps, 0, 'f', 1)
+            : tr("render rate %1 fps (%2 shown)")
+                .arg(s.fps, 0, 'f', 1)
+                .arg(seconds > 0. ? numPresented_ / seconds : 0., 0, 'f', 1);
+
+    // a busy ratio near 100% means the renderer is the bottleneck,
+    // otherwise the frames wait for the scheduler or the swap
+    emit statusMessage(tr("%1  frame %2 ms (max %3)  render %4 ms (max %5)  "
+                          "busy %6%  late %7  uniform uploads %8")
+                       .arg(rate)
+                       .arg(s.frameMs, 0, 'f', 2).arg(s.frameMaxMs, 0, 'f', 2)
+                       .arg(s.workMs, 0, 'f', 2).arg(s.workMaxMs, 0, 'f', 2)
+                       .arg(s.frameMs > 0. ? 100. * s.workMs / s.frameMs : 0., 0, 'f', 0)
+                       .arg(s.late)
+                       .arg(lastUniformUploads_)
+                       + (capture_.isCapturing()
+                          ? tr("  capture %1 frames (%2 queued, %3 stalls)")
+                            .arg(capture_.numCaptured())
+                            .arg(capture_.numQueued())
+                            .arg(capture_.numStalls())
+                          : QString()));
+}
+
+bool RenderWidget::startCapture(const QString &filename)
+{
+    if (capture_.isCapturing())
+        stopCapture();
+
+    updatePresentInterval_();
+    if (!capture_.start(filename, width(), height(), captureFps_()))
     {
-        SCH_CHECK_GL( glUniform1f(
-                          shader_->getShaderLocations().aspect,
-                          (float)width() / height()) );
+        emit statusMessage(capture_.error());
+        return false;
     }
 
+    emit statusMessage((doAnimation_
+                        ? tr("Capturing %1x%2 at %3 fps to %4")
+                        : tr("Capturing %1x%2 at %3 fps to %4, "
+                             "frames are recorded while the animation runs"))
+                       .arg(capture_.width()).arg(capture_.height())
+                       .arg(capture_.fps(), 0, 'f', 2).arg(filename));
+    update();
+    return true;
+}
+
+void RenderWidget::stopCapture()
+{
+    if (!capture_.isCapturing())
+        return;
+
+    makeCurrent();
+    capture_.stop();
+
+    emit statusMessage(tr("Capture finished, %1 of %2 frames written, %3 lost, %4 stalls")
+                       .arg(capture_.numWritten())
+                       .arg(capture_.numCaptured())
+                       .arg(capture_.numLost())
+                       .arg(capture_.numStalls()));
+}
+
+void RenderWidget::sendSpecialUniforms_()
+{
+    shader_->sendSpecialUniforms(projectionMatrix(), transformationMatrix(),
+                                 getTime(), (float)width() / height());
+}
+
+double RenderWidget::captureFps_() const
+{
+    // uncapped frames are captured when presented
+    const double fps = scheduler_->targetFps();
+    return fps > 0. ? fps : 1000. / presentIntervalMs_;
+}
+
+void RenderWidget::updatePresentInterval_()
+{
+    // the window might have been moved to another screen
+    QWindow * win = window()->windowHandle();
+    QScreen * screen = win ? win->screen() : QGuiApplication::primaryScreen();
+    const qreal hz = screen ? screen->refreshRate() : 0.;
+    presentIntervalMs_ = 1000. / (hz >= 1. ? hz : 60.);
 }
 
 void RenderWidget::startAnimation()
 {
+    updatePresentInterval_();
     doAnimation_ = true;
-    timer_.start();
-    update();
+    scheduler_->restartClock();
+    scheduler_->start();
+}
+
+void RenderWidget::stopAnimation()
+{
+    doAnimation_ = false;
+    scheduler_->stop();
 }
 
 float RenderWidget::getTime() const
 {
-    return (float)timer_.elapsed() / 1000.f;
+    return (float)scheduler_->time();
 }
 
 void RenderWidget::applyOptions_()
@@ -21,11 +21,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef RENDERWIDGET_H
 #define RENDERWIDGET_H
 
+#include <vector>
+
+#include <QElapsedTimer>
+
 #include "basic3dwidget.h"
+#include "frameprofiler.h"
+#include "pipelinestatistics.h"
+#include "framecapture.h"
 
 // forward decls.
 class Model;
 class Glsl;
+class FrameScheduler;
 
 /** Class to render a Model */
 class RenderWidget : public Basic3DWidget
@@ -39,12 +47,29 @@ public:
     /** Return current animation time in seconds. */
     float getTime() const;
 
+    /** Returns the scheduler that paces the animation,
+        e.g. to read the frame statistics */
+    FrameScheduler * frameScheduler() const { return scheduler_; }
+
+    /** Returns true while frames are recorded */
+    bool isCapturing() const { return capture_.isCapturing(); }
+
 signals:
 
     /** Emitted when shader was compiled after source-change,
         regardless of success. */
     void shaderCompiled();
 
+    /** Emitted with the readable result of a benchmark run */
+    void benchmarkFinished(const QString& result);
+
+    /** Some readable information for the status bar */
+    void statusMessage(const QString& text);
+
+    /** Readable pipeline statistics of the model draw,
+        when enabled with setPipelineStatistics() */
+    void pipelineStatistics(const QString& text);
+
 public slots:
 
     /** Applies AppSettings */
@@ -61,14 +86,31 @@ public slots:
         Ownership of class is taken! */
     void setShader(Glsl * s);
 
+    /** Enables counting the pipeline work of the model draw */
+    void setPipelineStatistics(bool enable);
+
+    /** Starts recording the animation frames to the file or file sequence.
+        Only frames paced by the FrameScheduler are recorded, when uncapped
+        only those that are presented, at the display rate.
+        The format follows the extension, see FrameCapture.
+        Returns false and reports through statusMessage() on errors. */
+    bool startCapture(const QString& filename);
+
+    /** Stops recording and waits for the pending frames to be written */
+    void stopCapture();
+
     /** Please compile the shader in next paintGL() */
     void requestCompileShader();
 
+    /** Runs one of the ModelBenchmark::Test's in next paintGL().
+        The result is reported by benchmarkFinished() */
+    void requestBenchmark(int test);
+
     /** Starts continuiosly rerendering the scene. */
     void startAnimation();
 
     /** Stops rerendering the scene all over. */
-    void stopAnimation() { doAnimation_ = false; }
+    void stopAnimation();
 
 protected:
 
@@ -84,6 +126,27 @@ protected:
 
     void initTextures_();
 
+    /** Sends the frame statistics of the last @p seconds as status message */
+    void emitFrameStats_(double seconds);
+
+    /** Frame rate of the recorded frames, the display rate when uncapped */
+    double captureFps_() const;
+
+    /** Takes the display rate for uncapped frames from the screen */
+    void updatePresentInterval_();
+
+    /** Draws the FrameProfiler overlay and restores the gl state */
+    void paintHud_();
+
+    /** Returns the readable pipeline statistics */
+    QString pipelineText_() const;
+
+private slots:
+
+    /** Reads pending pipeline statistics outside of paintGL(),
+        when no further frames are drawn */
+    void readPipelineStatistics_();
+
 private:
 
     Model * model_, * newModel_;
@@ -94,15 +157,34 @@ private:
 
     bool requestCompile_,
          requestTextureUpdate_,
+         requestBenchmark_,
          doAnimation_;
 
-    QTime timer_;
+    int benchmarkTest_;
+
+    /** uniform uploads of the previous frame */
+    int lastUniformUploads_;
+
+    FrameScheduler * scheduler_;
+    FrameProfiler profiler_;
+    PipelineStatistics pipelineStats_;
+    FrameCapture capture_;
+    /** time since the last pipelineStatistics() signal */
+    QElapsedTimer pipelineTimer_;
+    /** display rate for uncapped frames, from the screen's refresh rate */
+    double presentIntervalMs_;
+    /** uncapped frames presented since the last frame statistics */
+    int numPresented_;
+    /** time since the last status message and the last presented frame */
+    QElapsedTimer statsTimer_, presentTimer_;
 
     // options
     bool doDepthTest_,
          doCullFace_,
          doFrontFaceCCW_,
-         doDrawCoords_;
+         doDrawCoords_,
+         doShowHud_,
+         doPipelineStats_;
 };
 
 #endif // RENDERWIDGET_H
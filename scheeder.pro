@@ -16,6 +16,13 @@ macx: INCLUDEPATH += /usr/local/include
 
 QMAKE_CXXFLAGS += -DGLM_FORCE_RADIANS
 
+# lets std::sqrt compile to a vector instruction and gcc vectorize
+# loops of unknown length at -O2, e.g. in Model::calculateTriangleNormals()
+*-g++*|*-clang* {
+    QMAKE_CXXFLAGS += -fno-math-errno
+    QMAKE_CXXFLAGS_RELEASE += -ftree-vectorize
+}
+
 SOURCES += \
     main.cpp\
     mainwindow.cpp \
@@ -25,8 +32,19 @@ SOURCES += \
     appsettings.cpp \
     model.cpp \
     modelfactory.cpp \
+    modelbenchmark.cpp \
+    modelbuilder.cpp \
+    programcache.cpp \
     debug.cpp \
     glsl.cpp \
+    glslpreprocessor.cpp \
+    shadercompilethread.cpp \
+    framescheduler.cpp \
+    frameprofiler.cpp \
+    pipelinestatistics.cpp \
+    batchcompiler.cpp \
+    offscreenrenderer.cpp \
+    framecapture.cpp \
     glslhighlighter.cpp \
     uniformwidgetfactory.cpp \
     glslsyntax.cpp
@@ -40,9 +58,21 @@ HEADERS  += \
     appsettings.h \
     model.h \
     modelfactory.h \
+    modelbenchmark.h \
+    modelbuilder.h \
+    programcache.h \
     debug.h \
     glsl.h \
+    glslpreprocessor.h \
+    shadercompilethread.h \
+    framescheduler.h \
+    frameprofiler.h \
+    pipelinestatistics.h \
+    batchcompiler.h \
+    offscreenrenderer.h \
+    framecapture.h \
     opengl.h \
+    parallel.h \
     glslhighlighter.h \
     uniformwidgetfactory.h \
     teapot_data.h \
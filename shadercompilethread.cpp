@@ -0,0 +1,204 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#include <QCoreApplication>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include "shadercompilethread.h"
+#include "debug.h"
+
+ShaderCompileThread::ShaderCompileThread(QOpenGLContext * share)
+    :   context_    (new QOpenGLContext),
+        surface_    (new QOffscreenSurface),
+        valid_      (false),
+        quit_       (false),
+        nextTicket_ (1)
+{
+    // surface and context are created in the gui thread,
+    // the context is then moved to this thread
+    surface_->setFormat(share->format());
+    surface_->create();
+
+    context_->setFormat(share->format());
+    context_->setShareContext(share);
+    if (!context_->create())
+        return;
+
+    context_->moveToThread(this);
+    valid_ = true;
+    start();
+}
+
+ShaderCompileThread::~ShaderCompileThread()
+{
+    {
+        QMutexLocker lock(&mutex_);
+        quit_ = true;
+        wakeUp_.wakeAll();
+    }
+    wait();
+
+    delete context_;
+    delete surface_;
+}
+
+int ShaderCompileThread::compile(GLuint program, GLuint vertexShader, GLuint fragmentShader)
+{
+    Job job;
+    job.program = program;
+    job.shader[0] = vertexShader;
+    job.shader[1] = fragmentShader;
+    job.started = job.done = job.discarded = false;
+    job.result.compiled[0] = job.result.compiled[1] = job.result.linked = false;
+    job.result.compileMs[0] = job.result.compileMs[1] = job.result.linkMs = 0.;
+
+    QMutexLocker lock(&mutex_);
+    job.ticket = nextTicket_++;
+    jobs_.push_back(job);
+    wakeUp_.wakeAll();
+    return job.ticket;
+}
+
+std::list<ShaderCompileThread::Job>::iterator ShaderCompileThread::find_(int ticket)
+{
+    for (auto i = jobs_.begin(); i != jobs_.end(); ++i)
+        if (i->ticket == ticket)
+            return i;
+    return jobs_.end();
+}
+
+bool ShaderCompileThread::take(int ticket, Result& result)
+{
+    QMutexLocker lock(&mutex_);
+
+    auto job = find_(ticket);
+    if (job == jobs_.end() || !job->done)
+        return false;
+
+    result = job->result;
+    jobs_.erase(job);
+    return true;
+}
+
+bool ShaderCompileThread::discard(int ticket)
+{
+    QMutexLocker lock(&mutex_);
+
+    auto job = find_(ticket);
+    if (job == jobs_.end())
+        return false;
+
+    if (job->done)
+    {
+        jobs_.erase(job);
+        return false;
+    }
+
+    job->discarded = true;
+    return true;
+}
+
+void ShaderCompileThread::run()
+{
+    const bool current = context_->makeCurrent(surface_);
+#ifdef SCH_USE_QT_OPENGLFUNC
+    if (current)
+        initializeOpenGLFunctions();
+#endif
+
+    QMutexLocker lock(&mutex_);
+    for (;;)
+    {
+        // next job in line
+        auto job = jobs_.begin();
+        while (job != jobs_.end() && job->started)
+            ++job;
+
+        if (job == jobs_.end())
+        {
+            if (quit_)
+                break;
+            wakeUp_.wait(&mutex_);
+            continue;
+        }
+
+        // (the list keeps the iterator valid while unlocked)
+        job->started = true;
+        lock.unlock();
+        if (current)
+            process_(*job);
+        lock.relock();
+
+        job->done = true;
+        if (job->discarded)
+        {
+            if (current)
+            {
+                for (int i=0; i<2; ++i)
+                    if (job->shader[i])
+                        SCH_CHECK_GL( glDeleteShader(job->shader[i]) );
+                SCH_CHECK_GL( glDeleteProgram(job->program) );
+                SCH_CHECK_GL( glFlush() );
+            }
+            jobs_.erase(job);
+        }
+    }
+    lock.unlock();
+
+    if (current)
+        context_->doneCurrent();
+
+    // give the context back to the gui thread for destruction
+    context_->moveToThread(QCoreApplication::instance()->thread());
+}
+
+void ShaderCompileThread::process_(Job& job)
+{
+    QElapsedTimer timer;
+    GLint status;
+
+    // querying the status waits for the driver,
+    // so each stage and the link are timed on their own
+    for (int i=0; i<2; ++i)
+    {
+        if (!job.shader[i])
+        {
+            job.result.compiled[i] = true;
+            continue;
+        }
+        timer.start();
+        SCH_CHECK_GL( glCompileShader(job.shader[i]) );
+        SCH_CHECK_GL( glGetShaderiv(job.shader[i], GL_COMPILE_STATUS, &status) );
+        job.result.compileMs[i] = timer.nsecsElapsed() / 1000000.;
+        job.result.compiled[i] = status;
+    }
+
+    timer.start();
+    SCH_CHECK_GL( glLinkProgram(job.program) );
+    SCH_CHECK_GL( glGetProgramiv(job.program, GL_LINK_STATUS, &status) );
+    job.result.linkMs = timer.nsecsElapsed() / 1000000.;
+    job.result.linked = status;
+
+    // make the results visible to the gui context
+    SCH_CHECK_GL( glFinish() );
+}
@@ -0,0 +1,113 @@
+/***************************************************************************
+
+Copyright (C) 2014  stefan.berke @ modular-audio-graphics.com
+
+This source is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either
+version 3.0 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this software; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+****************************************************************************/
+
+#ifndef SHADERCOMPILETHREAD_H
+#define SHADERCOMPILETHREAD_H
+
+#include <list>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "opengl.h"
+
+class QOpenGLContext;
+class QOffscreenSurface;
+
+/** @brief Compiles and links shader programs on a thread with a shared context.
+
+    <p>This is the fallback of Glsl::beginCompile() for drivers without
+    KHR_parallel_shader_compile. The shader and program objects are created
+    and set up in the calling context. This thread only runs glCompileShader(),
+    glLinkProgram() and waits for their results, so the frames in the
+    calling context go on meanwhile.</p>
+
+    <p>Each compile() returns a ticket. A job that is not needed anymore is
+    discard()ed and the thread deletes it's objects once it's done with them.</p>
+*/
+class ShaderCompileThread : public QThread
+#ifdef SCH_USE_QT_OPENGLFUNC
+    , protected QOpenGLFunctions_3_3_Core
+#endif
+{
+public:
+
+    /** Result of one job */
+    struct Result
+    {
+        bool compiled[2], linked;
+        double compileMs[2], linkMs;
+    };
+
+    /** Creates a context that shares objects with @p share
+        and starts the thread. */
+    explicit ShaderCompileThread(QOpenGLContext * share);
+
+    /** Finishes the queued jobs and stops the thread */
+    ~ShaderCompileThread();
+
+    /** Returns true if the shared context could be created */
+    bool isValid() const { return valid_; }
+
+    /** Queues compiling the shaders and linking the program.
+        A shader of 0 is not compiled (e.g. taken from a cache).
+        The objects must be attached and flushed by the calling context.
+        Returns a ticket for the job. */
+    int compile(GLuint program, GLuint vertexShader, GLuint fragmentShader);
+
+    /** Returns true and the result when the job is finished.
+        The job is removed from the thread. */
+    bool take(int ticket, Result& result);
+
+    /** Removes the job. If it's still running, the thread deletes the
+        program and the shaders afterwards and true is returned.
+        Otherwise the objects belong to the caller. */
+    bool discard(int ticket);
+
+protected:
+
+    void run() Q_DECL_OVERRIDE;
+
+private:
+
+    struct Job
+    {
+        int ticket;
+        GLuint program, shader[2];
+        bool started, done, discarded;
+        Result result;
+    };
+
+    void process_(Job& job);
+
+    std::list<Job>::iterator find_(int ticket);
+
+    QOpenGLContext * context_;
+    QOffscreenSurface * surface_;
+    bool valid_, quit_;
+    int nextTicket_;
+
+    QMutex mutex_;
+    QWaitCondition wakeUp_;
+    std::list<Job> jobs_;
+};
+
+#endif // SHADERCOMPILETHREAD_H
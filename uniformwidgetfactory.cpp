@@ -41,6 +41,7 @@ bool UniformWidgetFactory::isSupported(GLenum type) const
         || type == GL_FLOAT_VEC2
         || type == GL_FLOAT_VEC3
         || type == GL_FLOAT_VEC4
+        || type == GL_INT
         || type == GL_SAMPLER_2D;
 }
 
@@ -95,6 +96,20 @@ QWidget * UniformWidgetFactory::getWidget(Uniform * uniform, QWidget *parent)
                     lh->addWidget( sb = getFloatWidget_(uniform, w, 3) );
                 }
                 break;
+                case GL_INT:
+                {
+                    auto sb = new QSpinBox(w);
+                    sb->setRange(-100000000, 100000000);
+                    sb->setValue(uniform->ints[0]);
+                    lh->addWidget(sb);
+                    connect(sb, static_cast<void(QSpinBox::*)(int)>( &QSpinBox::valueChanged ), [=](int i)
+                    {
+                        uniform->ints[0] = i;
+                        uniform->setChanged();
+                        uniformChanged(uniform);
+                    });
+                }
+                break;
                 case GL_SAMPLER_2D:
                 {
                     lh->addWidget(new QLabel(tr("select texture slot"), w));
@@ -105,6 +120,7 @@ QWidget * UniformWidgetFactory::getWidget(Uniform * uniform, QWidget *parent)
                     connect(sb, static_cast<void(QSpinBox::*)(int)>( &QSpinBox::valueChanged ), [=](int i)
                     {
                         uniform->ints[0] = i;
+                        uniform->setChanged();
                         uniformChanged(uniform);
                     });
                 }
@@ -146,6 +162,7 @@ QDoubleSpinBox * UniformWidgetFactory::getFloatWidget_(
         [=](double value)
         {
             uniform->floats[vecIndex] = value;
+            uniform->setChanged();
             uniformChanged(uniform);
         }
     );